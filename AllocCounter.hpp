@@ -0,0 +1,55 @@
+#pragma once
+
+// Opt-in counting of global heap allocations.
+//
+// Build with -DSSTACK_COUNT_ALLOCS (or "make allocs") to replace the global
+// operator new/delete with versions that tally every allocation.  Without the
+// flag this header only provides the (always zero) counters.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace alloc_counter {
+#ifdef SSTACK_COUNT_ALLOCS
+  constexpr bool enabled = true;
+#else
+  constexpr bool enabled = false;
+#endif
+
+  inline std::atomic<size_t> count{0};   // Number of calls to operator new
+  inline std::atomic<size_t> bytes{0};   // Total bytes requested
+}
+
+#ifdef SSTACK_COUNT_ALLOCS
+namespace alloc_counter {
+  // Print the totals to stderr when the program exits.
+  struct Reporter {
+    ~Reporter() {
+      std::fprintf(stderr, "allocations: %zu (%zu bytes)\n", count.load(), bytes.load());
+    }
+  };
+  inline Reporter reporter;
+}
+
+// All of these go through one pair of opaque calls.  Otherwise GCC inlines
+// operator new, sees the malloc() inside it and, finding a delete of the
+// same pointer, warns about a mismatched allocation
+// (-Wmismatched-new-delete).  noipa also stops it inferring that Allocate()
+// is malloc-like.
+namespace alloc_counter {
+  [[gnu::noipa]] inline void * Allocate(size_t size) { return std::malloc(size ? size : 1); }
+  [[gnu::noipa]] inline void Release(void * ptr) noexcept { std::free(ptr); }
+}
+
+void * operator new(size_t size) {
+  alloc_counter::count.fetch_add(1, std::memory_order_relaxed);
+  alloc_counter::bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void * ptr = alloc_counter::Allocate(size)) return ptr;
+  throw std::bad_alloc();
+}
+void operator delete(void * ptr) noexcept { alloc_counter::Release(ptr); }
+void operator delete(void * ptr, size_t) noexcept { alloc_counter::Release(ptr); }
+#endif
@@ -0,0 +1,347 @@
+#pragma once
+
+// Snapshots of a running program (--checkpoint-every, --restore).
+//
+// A Snapshot holds everything needed to resume at a statement boundary:
+// variables, the value stack, open blocks (including WHILE loops part way
+// through) and the IF/ELSE state.  Taking one is cheap because Values are
+// copy-on-write: the snapshot shares every string with the running program,
+// and a Checkpointer thread writes it to disk while the program carries on.
+// Only a value the program changes before the write finishes gets copied.
+//
+// File layout: a header (magic, version, source hash), then unsigned
+// LEB128 integers and length-prefixed strings in the order of Snapshot's
+// fields.  A file is written under a temporary name, synced and renamed, so
+// an interrupted write never replaces the previous checkpoint.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Stats.hpp"
+#include "Value.hpp"
+
+namespace checkpoint {
+  constexpr std::array<char, 8> MAGIC = { 'S', 'S', 'C', 'K', 'P', 'T', '\0', '\0' };
+  constexpr uint64_t VERSION = 3;
+
+  // An open block, with token positions in place of tokens.
+  struct Frame {
+    uint64_t type = 0;
+    uint64_t token_pos = 0;     // Token that opened the block
+    uint64_t cond_pos = 0;
+    uint64_t end_pos = 0;
+    uint64_t iterations = 0;
+  };
+
+  struct Snapshot {
+    uint64_t source_hash = 0;   // Of the program text, so a checkpoint only resumes its own script
+    uint64_t num_tokens = 0;
+    uint64_t pos = 0;           // Next token to run
+    bool last_if_condition = false;
+    bool just_processed_if = false;
+    bool inline_statement = false;
+    std::vector<Value> stack;
+    std::vector<std::vector<std::pair<std::string, Value>>> scopes;   // Outermost first
+    std::vector<std::pair<std::string, int64_t>> declaration_lines;
+    std::vector<Frame> frames;
+    stats::Counters counters;
+  };
+
+  // FNV-1a; stable across builds, unlike std::hash.
+  inline uint64_t Hash(std::string_view text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) hash = (hash ^ c) * 1099511628211ull;
+    return hash;
+  }
+
+  // Buffered output to a file descriptor; large strings bypass the buffer.
+  class FileWriter {
+  private:
+    int fd;
+    std::vector<char> buffer;
+    size_t used = 0;
+    bool ok = true;
+
+    void WriteAll(const char * data, size_t size) {
+      while (size > 0 && ok) {
+        const ssize_t done = ::write(fd, data, size);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) { ok = false; break; }
+        data += done;
+        size -= static_cast<size_t>(done);
+      }
+    }
+
+  public:
+    explicit FileWriter(int in_fd) : fd(in_fd), buffer(1 << 20) { }
+
+    void Bytes(const char * data, size_t size) {
+      if (used + size > buffer.size()) Flush();
+      if (size >= buffer.size()) { WriteAll(data, size); return; }
+      std::memcpy(buffer.data() + used, data, size);
+      used += size;
+    }
+    void Number(uint64_t value) {
+      char bytes[10];
+      size_t count = 0;
+      do {
+        bytes[count++] = static_cast<char>((value & 0x7f) | (value >= 0x80 ? 0x80 : 0));
+        value >>= 7;
+      } while (value);
+      Bytes(bytes, count);
+    }
+    void String(std::string_view text) { Number(text.size()); Bytes(text.data(), text.size()); }
+    bool Flush() { WriteAll(buffer.data(), used); used = 0; return ok; }
+  };
+
+  // Reads a mapped checkpoint; any overrun marks it as bad rather than throwing.
+  class FileReader {
+  private:
+    std::string_view data;
+    size_t pos = 0;
+    bool ok = true;
+
+  public:
+    explicit FileReader(std::string_view in) : data(in) { }
+
+    bool Ok() const { return ok; }
+    bool AtEnd() const { return pos == data.size(); }
+    void Fail() { ok = false; }
+
+    std::string_view Bytes(size_t size) {
+      if (size > data.size() - pos) { ok = false; pos = data.size(); return {}; }
+      pos += size;
+      return data.substr(pos - size, size);
+    }
+    uint64_t Number() {
+      uint64_t value = 0;
+      for (unsigned shift = 0; shift < 64; shift += 7) {
+        const std::string_view byte = Bytes(1);
+        if (!ok) return 0;
+        value |= static_cast<uint64_t>(byte[0] & 0x7f) << shift;
+        if (!(byte[0] & 0x80)) return value;
+      }
+      ok = false;
+      return 0;
+    }
+    std::string_view String() { return Bytes(Number()); }
+  };
+
+  inline void WriteCounters(FileWriter & out, const stats::Counters & counters) {
+    out.Number(counters.tokens);
+    out.Number(counters.statements);
+    for (uint64_t count : counters.operators) out.Number(count);
+    out.Number(counters.reused_results);
+    for (uint64_t count : counters.comparisons) out.Number(count);
+    out.Number(counters.scope_pushes);
+    out.Number(counters.scope_pops);
+    out.Number(counters.parallel_statements);
+    out.Number(counters.loops_compiled);
+    out.Number(counters.loops_rejected);
+    out.Number(counters.tier_ups);
+    out.Number(counters.values_compressed);
+    out.Number(counters.values_restored);
+    out.Number(counters.peak_cold_saved);
+    out.Number(counters.compress_nanoseconds);
+    out.Number(counters.restore_nanoseconds);
+  }
+
+  inline void ReadCounters(FileReader & in, stats::Counters & counters) {
+    counters.tokens = in.Number();
+    counters.statements = in.Number();
+    for (uint64_t & count : counters.operators) count = in.Number();
+    counters.reused_results = in.Number();
+    for (uint64_t & count : counters.comparisons) count = in.Number();
+    counters.scope_pushes = in.Number();
+    counters.scope_pops = in.Number();
+    counters.parallel_statements = in.Number();
+    counters.loops_compiled = in.Number();
+    counters.loops_rejected = in.Number();
+    counters.tier_ups = in.Number();
+    counters.values_compressed = in.Number();
+    counters.values_restored = in.Number();
+    counters.peak_cold_saved = in.Number();
+    counters.compress_nanoseconds = in.Number();
+    counters.restore_nanoseconds = in.Number();
+  }
+
+  // Write 'snap' to 'path' atomically; false on any I/O error.
+  inline bool Write(const std::string & path, const Snapshot & snap) {
+    const std::string temp = path + ".tmp";
+    const int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    FileWriter out(fd);
+    out.Bytes(MAGIC.data(), MAGIC.size());
+    out.Number(VERSION);
+    out.Number(snap.source_hash);
+    out.Number(snap.num_tokens);
+    out.Number(snap.pos);
+    out.Number(snap.last_if_condition | snap.just_processed_if << 1 | snap.inline_statement << 2);
+    out.Number(snap.stack.size());
+    for (const Value & value : snap.stack) out.String(value.view());
+    out.Number(snap.scopes.size());
+    for (const auto & scope : snap.scopes) {
+      out.Number(scope.size());
+      for (const auto & [name, value] : scope) { out.String(name); out.String(value.view()); }
+    }
+    out.Number(snap.declaration_lines.size());
+    for (const auto & [name, line] : snap.declaration_lines) {
+      out.String(name);
+      out.Number(static_cast<uint64_t>(line));
+    }
+    out.Number(snap.frames.size());
+    for (const Frame & frame : snap.frames) {
+      out.Number(frame.type);
+      out.Number(frame.token_pos);
+      out.Number(frame.cond_pos);
+      out.Number(frame.end_pos);
+      out.Number(frame.iterations);
+    }
+    WriteCounters(out, snap.counters);
+    const bool ok = out.Flush() && ::fdatasync(fd) == 0;
+    if (::close(fd) != 0 || !ok) { ::unlink(temp.c_str()); return false; }
+    return ::rename(temp.c_str(), path.c_str()) == 0;
+  }
+
+  // Load a checkpoint; on failure returns false and describes why in 'error'.
+  inline bool Read(const std::string & path, Snapshot & snap, std::string & error) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || ::fstat(fd, &info) != 0) {
+      if (fd >= 0) ::close(fd);
+      error = "unable to open checkpoint '" + path + "'";
+      return false;
+    }
+    const size_t size = static_cast<size_t>(info.st_size);
+    void * map = size ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (map == MAP_FAILED) {
+      error = "unable to read checkpoint '" + path + "'";
+      return false;
+    }
+    ::madvise(map, size, MADV_SEQUENTIAL);
+
+    FileReader in({ static_cast<const char *>(map), size });
+    const bool right_format =
+      in.Bytes(MAGIC.size()) == std::string_view(MAGIC.data(), MAGIC.size()) && in.Number() == VERSION;
+    if (right_format) {
+      snap.source_hash = in.Number();
+      snap.num_tokens = in.Number();
+      snap.pos = in.Number();
+      const uint64_t flags = in.Number();
+      snap.last_if_condition = flags & 1;
+      snap.just_processed_if = flags & 2;
+      snap.inline_statement = flags & 4;
+      // Counts are checked against what remains so a corrupt file can't
+      // trigger a huge allocation.
+      auto count = [&] {
+        const uint64_t n = in.Number();
+        if (n <= size) return n;
+        in.Fail();
+        return uint64_t{0};
+      };
+      snap.stack.resize(count());
+      for (Value & value : snap.stack) value = Value(in.String());
+      snap.scopes.resize(count());
+      for (auto & scope : snap.scopes) {
+        scope.resize(count());
+        for (auto & [name, value] : scope) { name = in.String(); value = Value(in.String()); }
+      }
+      snap.declaration_lines.resize(count());
+      for (auto & [name, line] : snap.declaration_lines) {
+        name = in.String();
+        line = static_cast<int64_t>(in.Number());
+      }
+      snap.frames.resize(count());
+      for (Frame & frame : snap.frames) {
+        frame.type = in.Number();
+        frame.token_pos = in.Number();
+        frame.cond_pos = in.Number();
+        frame.end_pos = in.Number();
+        frame.iterations = in.Number();
+      }
+      ReadCounters(in, snap.counters);
+    }
+    const bool ok = right_format && in.Ok() && in.AtEnd();
+    ::munmap(map, size);
+    if (!ok) error = "'" + path + "' is not a valid checkpoint";
+    return ok;
+  }
+
+  // Asks for a snapshot every 'interval' and writes each one in the
+  // background.  The interpreter polls Due() between statements; the clock
+  // starts again once a write has finished, so a slow disk can't queue up
+  // snapshots.
+  class Checkpointer {
+  private:
+    std::string path;
+    std::chrono::nanoseconds interval;
+    std::atomic<bool> due{false};
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::optional<Snapshot> pending;
+    bool stopping = false;
+    std::jthread thread;          // Last, so it starts after everything above
+
+    void Loop() {
+      bool reported = false;
+      std::unique_lock lock(mutex);
+      while (true) {
+        if (wake.wait_for(lock, interval, [&] { return stopping; })) return;
+        due.store(true, std::memory_order_relaxed);
+        wake.wait(lock, [&] { return pending || stopping; });
+        if (!pending) return;
+        Snapshot snap = std::move(*pending);
+        pending.reset();
+        lock.unlock();
+        if (!Write(path, snap) && !reported) {
+          std::cerr << "WARNING: unable to write checkpoint '" << path << "'" << std::endl;
+          reported = true;
+        }
+        snap = {};                // Release the shared values before waiting again.
+        lock.lock();
+      }
+    }
+
+  public:
+    Checkpointer(std::string in_path, std::chrono::nanoseconds in_interval)
+      : path(std::move(in_path)), interval(in_interval), thread([this] { Loop(); }) { }
+
+    ~Checkpointer() {
+      { std::lock_guard lock(mutex); stopping = true; }
+      wake.notify_all();
+    }
+
+    Checkpointer(const Checkpointer &) = delete;
+    Checkpointer & operator=(const Checkpointer &) = delete;
+
+    bool Due() const { return due.load(std::memory_order_relaxed); }
+
+    void Submit(Snapshot && snap) {
+      {
+        std::lock_guard lock(mutex);
+        pending = std::move(snap);
+        due.store(false, std::memory_order_relaxed);
+      }
+      wake.notify_all();
+    }
+  };
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+// Compression for values that have gone cold (--compress-cold).
+//
+// A small LZ77 codec in the spirit of LZ4: a hash table of 4-byte sequences
+// finds earlier copies of the text ahead, and the output is a list of
+// sequences, each a run of literal bytes followed by a copy of something
+// earlier.  It trades ratio for speed, but the values scripts keep around
+// (logs, repeated records, padding) still shrink several times over.
+//
+// Format: sequences of [literal count][literals][match length][distance],
+// all numbers unsigned LEB128 and match lengths stored as length - 3.  The
+// last sequence has a match length of 0 and no distance.  Distances may
+// reach back to the start of the value.
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace lz {
+  constexpr size_t MIN_MATCH = 4;
+  constexpr unsigned HASH_BITS = 16;
+
+  inline void PutNumber(std::string & out, uint64_t value) {
+    do {
+      out.push_back(static_cast<char>((value & 0x7f) | (value >= 0x80 ? 0x80 : 0)));
+      value >>= 7;
+    } while (value);
+  }
+
+  inline bool GetNumber(std::string_view in, size_t & pos, uint64_t & value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+      const unsigned char byte = static_cast<unsigned char>(in[pos++]);
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return true;
+    }
+    return false;
+  }
+
+  inline uint32_t Load32(const char * p) { uint32_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+  inline uint64_t Load64(const char * p) { uint64_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+  inline uint32_t Hash(uint32_t word) { return (word * 2654435761u) >> (32 - HASH_BITS); }
+
+  // Length of the common prefix of 'a' and 'b', comparing up to 'limit' bytes.
+  inline size_t MatchLength(const char * a, const char * b, size_t limit) {
+    size_t length = 0;
+    while (length + 8 <= limit) {
+      const uint64_t diff = Load64(a + length) ^ Load64(b + length);
+      if (diff) return length + std::countr_zero(diff) / 8;   // Little-endian
+      length += 8;
+    }
+    while (length < limit && a[length] == b[length]) ++length;
+    return length;
+  }
+
+  inline std::string Compress(std::string_view in) {
+    std::string out;
+    out.reserve(in.size() / 4 + 16);
+    std::vector<size_t> table(size_t{1} << HASH_BITS, SIZE_MAX);   // Last position of each hash
+    const size_t n = in.size();
+    size_t literal_start = 0, pos = 0, misses = 0;
+    while (n >= MIN_MATCH && pos <= n - MIN_MATCH) {
+      const uint32_t word = Load32(in.data() + pos);
+      const size_t candidate = std::exchange(table[Hash(word)], pos);
+      if (candidate == SIZE_MAX || Load32(in.data() + candidate) != word) {
+        pos += 1 + (misses++ >> 6);    // Skip ahead faster through text that doesn't repeat.
+        continue;
+      }
+      misses = 0;
+      const size_t length = MIN_MATCH + MatchLength(in.data() + candidate + MIN_MATCH,
+                                                    in.data() + pos + MIN_MATCH, n - pos - MIN_MATCH);
+      PutNumber(out, pos - literal_start);
+      out.append(in.data() + literal_start, pos - literal_start);
+      PutNumber(out, length - MIN_MATCH + 1);
+      PutNumber(out, pos - candidate);
+      pos += length;
+      literal_start = pos;
+    }
+    PutNumber(out, n - literal_start);
+    out.append(in.substr(literal_start));
+    PutNumber(out, 0);
+    return out;
+  }
+
+  // Expand 'packed' into the 'size' bytes at 'out'.  False if it doesn't
+  // decode to exactly that many.
+  inline bool Decompress(std::string_view packed, char * out, size_t size) {
+    size_t in_pos = 0, out_pos = 0;
+    while (true) {
+      uint64_t literals = 0, match = 0, distance = 0;
+      if (!GetNumber(packed, in_pos, literals) || literals > size - out_pos ||
+          literals > packed.size() - in_pos) {
+        return false;
+      }
+      std::memcpy(out + out_pos, packed.data() + in_pos, literals);
+      in_pos += literals;
+      out_pos += literals;
+      if (!GetNumber(packed, in_pos, match)) return false;
+      if (match == 0) return out_pos == size && in_pos == packed.size();
+      const uint64_t length = match + MIN_MATCH - 1;
+      if (!GetNumber(packed, in_pos, distance) || distance == 0 || distance > out_pos ||
+          length > size - out_pos) {
+        return false;
+      }
+      // A copy may overlap what it produces (a repeating pattern); copying in
+      // steps no longer than the distance so far keeps each step's source
+      // already written.
+      const char * from = out + out_pos - distance;
+      for (size_t left = length; left > 0; ) {
+        const size_t step = std::min<size_t>(left, out + out_pos - from);
+        std::memcpy(out + out_pos, from, step);
+        out_pos += step;
+        left -= step;
+      }
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <exception>
+#include <sstream>
+#include <string>
+
+// Broad category of a problem found while lexing or running a program.
+enum class DiagnosticKind {
+  Lexical,   // Malformed input found by the lexer.
+  Syntax,    // Tokens in an order the language does not allow.
+  Runtime,   // A well-formed statement that cannot be executed (unknown variable, etc.)
+  StepLimit,     // Ran more statements than --max-steps allows.
+  MemoryLimit,   // Values grew past --max-memory.
+  Timeout,       // Ran longer than --timeout.
+};
+
+// A structured error report.  Errors are thrown as Diagnostics so that the
+// interpreter can be reused in-process; main() is responsible for flushing any
+// pending program output and then printing what().
+class Diagnostic : public std::exception {
+private:
+  DiagnosticKind kind;
+  size_t line;
+  size_t column;       // 1-based; 0 if unknown.
+  std::string message;
+  std::string full;    // Pre-formatted "ERROR (line N): message"
+
+public:
+  Diagnostic(DiagnosticKind kind, size_t line, size_t column, std::string message)
+    : kind(kind), line(line), column(column), message(std::move(message))
+    , full("ERROR (line " + std::to_string(line) + "): " + this->message) { }
+
+  DiagnosticKind GetKind() const { return kind; }
+  size_t GetLine() const { return line; }
+  size_t GetColumn() const { return column; }
+  const std::string & GetMessage() const { return message; }
+
+  const char * what() const noexcept override { return full.c_str(); }
+
+  // Process exit status to use when this diagnostic terminates a run; each
+  // kind of exhausted budget gets its own so callers can tell them apart.
+  int ExitCode() const {
+    switch (kind) {
+      case DiagnosticKind::StepLimit:   return 3;
+      case DiagnosticKind::MemoryLimit: return 4;
+      case DiagnosticKind::Timeout:     return 5;
+      default:                          return 1;
+    }
+  }
+};
+
+// Build and throw a Diagnostic from any streamable message pieces.
+template <typename... Ts>
+[[noreturn]] void ThrowDiagnostic(DiagnosticKind kind, size_t line, size_t column, Ts &&... message) {
+  std::ostringstream os;
+  (os << ... << std::forward<Ts>(message));
+  throw Diagnostic(kind, line, column, os.str());
+}
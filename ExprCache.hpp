@@ -0,0 +1,136 @@
+#pragma once
+
+// Common subexpression elimination over straight-line code.
+//
+// Operands in ParseExpr get value numbers: variables are numbered by their
+// storage (so a shadowing VAR is a different variable) and literals by their
+// text, and the result of "a <op> b" is numbered by (op, a, b).  Operands
+// are only numbered once an operator needs them, so expressions that can't
+// be reused (such as "x = x + y", which updates x in place) cost nothing.  Results
+// are remembered, so when the same operation on the same numbers comes up
+// again its stored Value (a shared, reference-counted copy) is reused instead
+// of searching the string again.
+//
+// Assigning a variable forgets it and everything computed from it, and the
+// interpreter clears the cache at control flow, so entries never outlive the
+// straight-line stretch of code they were computed in.
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "Value.hpp"
+
+class ExprCache {
+public:
+  using Number = uint32_t;
+  static constexpr Number UNKNOWN = 0;       // Not numbered (yet)
+  static constexpr size_t MAX_ENTRIES = 64;  // Per table; the cache is cleared beyond this
+
+  // An operand of ParseExpr; by default, one that is never reused.
+  struct Operand {
+    Number number = UNKNOWN;
+    const Value * variable = nullptr;
+    std::string_view literal{};
+    bool is_literal = false;
+
+    static Operand Variable(const Value & storage) { return { .variable = &storage }; }
+    static Operand Literal(std::string_view text) { return { .literal = text, .is_literal = true }; }
+  };
+
+private:
+  struct Variable { const Value * storage; Number number; };
+  struct Literal { std::string_view text; Number number; };
+  struct Result {
+    int op;
+    Number left, right;
+    Number number;
+    Value value;
+  };
+
+  std::vector<Variable> variables;
+  std::vector<Literal> literals;
+  std::vector<Result> results;     // In the order computed, so operands come first.
+  Number next_number = UNKNOWN + 1;
+  std::vector<Number> dead;        // Scratch space for Forget()
+
+  Number Fresh() {
+    if (std::max({ variables.size(), literals.size(), results.size() }) >= MAX_ENTRIES) Clear();
+    return next_number++;
+  }
+
+  Number VariableNumber(const Value & storage) {
+    for (const Variable & var : variables) if (var.storage == &storage) return var.number;
+    const Number number = Fresh();
+    variables.push_back({ &storage, number });
+    return number;
+  }
+
+  Number LiteralNumber(std::string_view text) {
+    for (const Literal & lit : literals) if (lit.text == text) return lit.number;
+    const Number number = Fresh();
+    literals.push_back({ text, number });
+    return number;
+  }
+
+  Number NumberOf(Operand & operand) {
+    if (operand.number == UNKNOWN) {
+      if (operand.variable) operand.number = VariableNumber(*operand.variable);
+      else if (operand.is_literal) operand.number = LiteralNumber(operand.literal);
+    }
+    return operand.number;
+  }
+
+  static bool Opaque(const Operand & operand) {
+    return operand.number == UNKNOWN && !operand.variable && !operand.is_literal;
+  }
+
+public:
+  void Clear() {
+    variables.clear();
+    literals.clear();
+    results.clear();
+  }
+
+  // If "left op right" was computed before, copy it into 'out', make 'left'
+  // stand for it and return true.
+  bool Lookup(int op, Operand & left, Operand & right, Value & out) {
+    if (Opaque(left) || Opaque(right)) return false;
+    const Number left_number = NumberOf(left), right_number = NumberOf(right);
+    for (const Result & result : results) {
+      if (result.op == op && result.left == left_number && result.right == right_number) {
+        out = result.value;
+        left = { .number = result.number };
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Record 'value' as the result of "left op right"; 'left' then stands for it.
+  void Remember(int op, Operand & left, Operand & right, const Value & value) {
+    if (Opaque(left) || Opaque(right)) { left = {}; return; }
+    const Number left_number = NumberOf(left), right_number = NumberOf(right);
+    const Number number = Fresh();
+    results.push_back({ op, left_number, right_number, number, value });
+    left = { .number = number };
+  }
+
+  // 'storage' is about to change (or just did): drop its number and every
+  // result that depends on it.
+  void Forget(const Value & storage) {
+    auto var = std::find_if(variables.begin(), variables.end(),
+      [&](const Variable & v) { return v.storage == &storage; });
+    if (var == variables.end()) return;
+    dead.assign(1, var->number);
+    variables.erase(var);
+    auto is_dead = [&](Number number) { return std::find(dead.begin(), dead.end(), number) != dead.end(); };
+    auto kept = results.begin();
+    for (auto it = results.begin(); it != results.end(); ++it) {
+      if (is_dead(it->left) || is_dead(it->right)) dead.push_back(it->number);
+      else if (kept++ != it) *(kept - 1) = std::move(*it);
+    }
+    results.erase(kept, results.end());
+  }
+};
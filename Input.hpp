@@ -0,0 +1,80 @@
+#pragma once
+
+// Line-by-line reading of standard input for READ.
+//
+// Input is pulled in large blocks with read(2) and lines are handed out as
+// views into the block, so a script can filter inputs far bigger than memory:
+// only the current block (plus the longest line, if one spans two blocks) is
+// ever held.
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+class LineReader {
+private:
+  int fd;
+  size_t block_size;
+  std::vector<char> buffer;
+  size_t pos = 0;             // Start of the unread part of 'buffer'
+  size_t end = 0;             // End of the valid data in 'buffer'
+  bool at_eof = false;        // read() has reported end of input
+  std::string spill;          // A line that crosses a block boundary
+
+  // Refill 'buffer' with the next block; false once input is exhausted.
+  bool Fill() {
+    pos = end = 0;
+    if (buffer.empty()) buffer.resize(block_size);   // Only scripts that READ need it.
+    while (!at_eof) {
+      const ssize_t got = ::read(fd, buffer.data(), buffer.size());
+      if (got > 0) { end = static_cast<size_t>(got); return true; }
+      if (got < 0 && errno == EINTR) continue;
+      at_eof = true;          // End of input (or an unreadable stdin).
+    }
+    return false;
+  }
+
+  static std::string_view Trim(std::string_view line) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    return line;
+  }
+
+public:
+  static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+  explicit LineReader(int in_fd = STDIN_FILENO, size_t in_block_size = BLOCK_SIZE)
+    : fd(in_fd), block_size(in_block_size) { }
+
+  // Next line without its line ending ("\n" or "\r\n"), valid until the next
+  // call.  Returns false at end of input; a final line with no newline still
+  // counts as a line.
+  bool Next(std::string_view & line) {
+    spill.clear();
+    while (true) {
+      if (pos == end && !Fill()) {
+        if (spill.empty()) return false;
+        line = Trim(spill);
+        return true;
+      }
+      const char * start = buffer.data() + pos;
+      const void * newline = std::memchr(start, '\n', end - pos);
+      if (newline) {
+        const size_t length = static_cast<size_t>(static_cast<const char *>(newline) - start);
+        pos += length + 1;
+        if (spill.empty()) {
+          line = Trim({ start, length });
+        } else {
+          spill.append(start, length);
+          line = Trim(spill);
+        }
+        return true;
+      }
+      spill.append(start, end - pos);   // Line continues in the next block.
+      pos = end;
+    }
+  }
+};
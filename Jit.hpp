@@ -0,0 +1,158 @@
+#pragma once
+
+// Machine code for hot loops (--jit).
+//
+// This is a template JIT: the interpreter walks a loop's tokens once and, for
+// each statement, asks an Assembler for the same few instruction patterns --
+// load pointer arguments, call a C++ helper, test its result, jump.  There
+// is no register allocation or optimization here; the gain is in skipping
+// the per-token work of parsing, looking up variables and checking syntax on
+// every iteration.
+//
+// Code is emitted into a plain buffer and then copied into its own mmap'd
+// pages, which are made executable only once they are no longer writable.
+// Only x86-64 code is generated; elsewhere 'supported' is false and loops
+// are always interpreted.
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace jit {
+#if defined(__x86_64__) && defined(__linux__)
+  constexpr bool supported = true;
+#else
+  constexpr bool supported = false;
+#endif
+
+  // Generated code: a function taking no arguments and returning a status.
+  class Code {
+  private:
+    void * memory = nullptr;
+    size_t size = 0;
+
+  public:
+    Code() = default;
+
+    // Copy 'bytes' into fresh pages and make them executable (and read-only).
+    explicit Code(const std::vector<uint8_t> & bytes) {
+      if (!supported || bytes.empty()) return;
+      const size_t page = 4096;
+      size = (bytes.size() + page - 1) / page * page;
+      memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (memory == MAP_FAILED) { memory = nullptr; return; }
+      std::memcpy(memory, bytes.data(), bytes.size());
+      if (::mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        ::munmap(memory, size);
+        memory = nullptr;
+      }
+    }
+
+    ~Code() { if (memory) ::munmap(memory, size); }
+
+    Code(Code && in) noexcept : memory(std::exchange(in.memory, nullptr)), size(in.size) { }
+    Code & operator=(Code && in) noexcept {
+      std::swap(memory, in.memory);
+      std::swap(size, in.size);
+      return *this;
+    }
+
+    bool Ok() const { return memory != nullptr; }
+
+    uint64_t operator()() const { return reinterpret_cast<uint64_t (*)()>(memory)(); }
+  };
+
+  // Emits the handful of x86-64 instruction patterns the loop compiler needs.
+  // Helpers are called through rax with their arguments loaded as 64-bit
+  // immediates, so everything they touch must stay at a fixed address for
+  // as long as the code is in use.  Boolean results come back in al.
+  class Assembler {
+  private:
+    enum Reg : uint8_t { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7 };
+
+    struct Label {
+      size_t pos = SIZE_MAX;               // Where it was bound
+      std::vector<size_t> uses;            // rel32 fields that jump to it
+    };
+
+    std::vector<uint8_t> code;
+    std::vector<Label> labels;
+
+    void Byte(uint8_t byte) { code.push_back(byte); }
+    void Bytes(std::initializer_list<uint8_t> bytes) { code.insert(code.end(), bytes); }
+    void Imm32(uint32_t value) {
+      for (int i = 0; i < 4; ++i) Byte(static_cast<uint8_t>(value >> (8 * i)));
+    }
+    void Imm64(uint64_t value) {
+      for (int i = 0; i < 8; ++i) Byte(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    void MovImm(Reg reg, uint64_t value) {         // mov reg, imm64
+      Bytes({ 0x48, static_cast<uint8_t>(0xB8 + reg) });
+      Imm64(value);
+    }
+
+    void Rel32(size_t label) {
+      labels[label].uses.push_back(code.size());
+      Imm32(0);
+    }
+
+  public:
+    Assembler() { Byte(0x53); }                     // push rbx: keeps the stack 16-byte aligned
+
+    size_t NewLabel() { labels.emplace_back(); return labels.size() - 1; }
+    void Bind(size_t label) { labels[label].pos = code.size(); }
+
+    // fun(args...) for up to four integer or pointer arguments.
+    template <typename FUN_T>
+    void Call(FUN_T * fun, std::initializer_list<uint64_t> args) {
+      constexpr Reg arg_regs[] = { RDI, RSI, RDX, RCX };
+      size_t i = 0;
+      for (uint64_t arg : args) MovImm(arg_regs[i++], arg);
+      MovImm(RAX, reinterpret_cast<uint64_t>(fun));
+      Bytes({ 0xFF, 0xD0 });                        // call rax
+    }
+
+    void JumpIfFalse(size_t label) { Bytes({ 0x84, 0xC0, 0x0F, 0x84 }); Rel32(label); }   // test al,al; jz
+    void JumpIfTrue(size_t label)  { Bytes({ 0x84, 0xC0, 0x0F, 0x85 }); Rel32(label); }   // test al,al; jnz
+
+    void AddTo(uint64_t * counter, uint32_t amount) {   // add qword [counter], amount
+      MovImm(RAX, reinterpret_cast<uint64_t>(counter));
+      Bytes({ 0x48, 0x81, 0x00 });
+      Imm32(amount);
+    }
+    void StoreResult(bool * flag) {                      // mov byte [flag], al
+      MovImm(RCX, reinterpret_cast<uint64_t>(flag));
+      Bytes({ 0x88, 0x01 });
+    }
+    void Store(bool * flag, bool value) {                // mov byte [flag], value
+      MovImm(RCX, reinterpret_cast<uint64_t>(flag));
+      Bytes({ 0xC6, 0x01, static_cast<uint8_t>(value) });
+    }
+    void Load(const bool * flag) {                       // movzx eax, byte [flag]
+      MovImm(RCX, reinterpret_cast<uint64_t>(flag));
+      Bytes({ 0x0F, 0xB6, 0x01 });
+    }
+
+    void Return(uint32_t status) {                       // mov eax, status; pop rbx; ret
+      Byte(0xB8);
+      Imm32(status);
+      Bytes({ 0x5B, 0xC3 });
+    }
+
+    // The finished code, with every jump pointing at its label.
+    std::vector<uint8_t> Finish() {
+      for (const Label & label : labels) {
+        for (size_t use : label.uses) {
+          const uint32_t rel = static_cast<uint32_t>(label.pos - (use + 4));
+          std::memcpy(code.data() + use, &rel, sizeof(rel));
+        }
+      }
+      return std::move(code);
+    }
+  };
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// Execution budgets (--max-steps, --max-memory, --timeout).
+//
+// Budgets are only checked at WHILE backedges: code without loops always
+// finishes in time proportional to its length, so a loop iteration is the
+// only place a program can run away.  Each check is a few comparisons; the
+// clock is never read on the fast path because a Watchdog thread raises a
+// flag when time runs out.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+
+struct Limits {
+  size_t max_steps = 0;     // Statements executed; 0 means no limit.
+  size_t max_memory = 0;    // Bytes held by values; 0 means no limit.
+  double timeout = 0.0;     // Wall-clock seconds; 0 means no limit.
+};
+
+// Sets a flag once a time limit has passed.
+class Watchdog {
+private:
+  std::atomic<bool> expired{false};
+  std::jthread thread;      // Stopped and joined on destruction.
+
+public:
+  void Start(std::chrono::nanoseconds limit) {
+    thread = {};              // Stop any earlier watch (--watch reruns).
+    expired.store(false, std::memory_order_relaxed);
+    thread = std::jthread([this, limit](std::stop_token stop) {
+      std::mutex mutex;
+      std::condition_variable_any wake;
+      std::unique_lock lock(mutex);
+      // Returns early (with stop requested) if the program finishes first.
+      wake.wait_for(lock, stop, limit, [] { return false; });
+      if (!stop.stop_requested()) expired.store(true, std::memory_order_relaxed);
+    });
+  }
+
+  bool Expired() const { return expired.load(std::memory_order_relaxed); }
+};
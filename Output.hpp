@@ -0,0 +1,149 @@
+#pragma once
+
+// Writing program output.
+//
+// WriteGathered() sends a list of pieces with writev(2); PRINT uses it for
+// large values so they go out straight from variable storage.
+//
+// AsyncOutput is double-buffered output written by a background thread
+// (--async-output).  PRINT keeps appending to one buffer while a writer
+// thread hands the other to write(2), so a slow pipe or disk only stalls the
+// interpreter once both buffers are full.  Flushing the stream waits until
+// everything written so far has reached the file descriptor, which keeps
+// output ordered with respect to error messages on stderr.
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Write 'pieces' to 'fd' back to back with writev(2), straight from wherever
+// they are stored.  False if a write fails.
+inline bool WriteGathered(int fd, const std::vector<std::string_view> & pieces) {
+  constexpr size_t BATCH = IOV_MAX < 1024 ? IOV_MAX : 1024;
+  iovec iov[BATCH];
+  for (size_t i = 0; i < pieces.size(); ) {
+    size_t count = 0;
+    for ( ; i < pieces.size() && count < BATCH; ++i) {
+      if (pieces[i].empty()) continue;
+      iov[count++] = { const_cast<char *>(pieces[i].data()), pieces[i].size() };
+    }
+    for (iovec * next = iov; count > 0; ) {
+      const ssize_t done = ::writev(fd, next, static_cast<int>(count));
+      if (done < 0 && errno == EINTR) continue;
+      if (done <= 0) return false;
+      // Skip what was written; a piece may have gone out in part.
+      for (size_t left = static_cast<size_t>(done); left > 0; ) {
+        const size_t step = std::min(left, next->iov_len);
+        next->iov_base = static_cast<char *>(next->iov_base) + step;
+        next->iov_len -= step;
+        left -= step;
+        if (next->iov_len == 0) { ++next; --count; }
+      }
+    }
+  }
+  return true;
+}
+
+class AsyncOutput : public std::streambuf {
+private:
+  int fd;
+  std::ostream & stream;           // Redirected to us until destruction
+  std::streambuf * previous;       // ...and restored to this afterwards
+  std::vector<char> front;         // Being filled by the interpreter (the put area)
+  std::vector<char> back;          // Being written by the writer thread
+  size_t back_size = 0;            // Bytes of 'back' still to write; 0 once it is free
+  bool failed = false;             // A write failed; later output is dropped
+  bool stopping = false;
+
+  std::mutex mutex;
+  std::condition_variable ready;   // 'back' has data (or we are stopping)
+  std::condition_variable drained; // 'back' is free again
+  std::jthread writer;             // Last, so it starts after everything above
+
+  void WriteAll(const char * data, size_t size) {
+    while (size > 0 && !failed) {
+      const ssize_t done = ::write(fd, data, size);
+      if (done < 0 && errno == EINTR) continue;
+      if (done <= 0) { failed = true; break; }
+      data += done;
+      size -= static_cast<size_t>(done);
+    }
+  }
+
+  void WriterLoop() {
+    std::unique_lock lock(mutex);
+    while (true) {
+      ready.wait(lock, [&] { return back_size > 0 || stopping; });
+      if (back_size == 0) return;
+      lock.unlock();
+      WriteAll(back.data(), back_size);   // 'back' is ours until back_size is reset.
+      lock.lock();
+      back_size = 0;
+      drained.notify_all();
+    }
+  }
+
+  // Pass the filled part of 'front' to the writer, waiting for the previous
+  // batch to finish first if it has not (backpressure).
+  void HandOff() {
+    const size_t size = static_cast<size_t>(pptr() - pbase());
+    if (size == 0) return;
+    {
+      std::unique_lock lock(mutex);
+      drained.wait(lock, [&] { return back_size == 0; });
+      front.swap(back);
+      back_size = size;
+    }
+    ready.notify_one();
+    setp(front.data(), front.data() + front.size());
+  }
+
+protected:
+  int_type overflow(int_type ch) override {
+    HandOff();
+    if (traits_type::eq_int_type(ch, traits_type::eof())) return traits_type::not_eof(ch);
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+  }
+
+  int sync() override {
+    HandOff();
+    std::unique_lock lock(mutex);
+    drained.wait(lock, [&] { return back_size == 0; });
+    return failed ? -1 : 0;
+  }
+
+public:
+  static constexpr size_t BUFFER_SIZE = 256 * 1024;
+
+  AsyncOutput(int in_fd, std::ostream & in_stream, size_t buffer_size = BUFFER_SIZE)
+    : fd(in_fd), stream(in_stream), previous(in_stream.rdbuf()),
+      front(std::max<size_t>(buffer_size, 1)), back(front.size()),
+      writer([this] { WriterLoop(); })
+  {
+    setp(front.data(), front.data() + front.size());
+    stream.flush();               // Anything already buffered goes out first.
+    stream.rdbuf(this);
+  }
+
+  ~AsyncOutput() {
+    sync();
+    stream.rdbuf(previous);
+    { std::lock_guard lock(mutex); stopping = true; }
+    ready.notify_one();
+  }
+
+  AsyncOutput(const AsyncOutput &) = delete;
+  AsyncOutput & operator=(const AsyncOutput &) = delete;
+};
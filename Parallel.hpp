@@ -0,0 +1,62 @@
+#pragma once
+
+// Multi-threaded kernels for operators on very large values.
+//
+// A search or copy over hundreds of MB is split into fixed-size chunks that
+// the shared ThreadPool works through.  Anything below MIN_BYTES keeps the
+// plain single-threaded path, since waking workers costs more than it saves.
+// The pool defaults to ThreadPool::Shared(), which is only looked up once an
+// operation is known to be large enough, so small values never start it.
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string_view>
+
+#include "ThreadPool.hpp"
+
+namespace parallel {
+  static constexpr size_t MIN_BYTES = 16 << 20;   // Smallest operation worth splitting
+  static constexpr size_t CHUNK_SIZE = 4 << 20;   // Bytes per task
+
+  inline size_t NumChunks(size_t bytes) { return (bytes + CHUNK_SIZE - 1) / CHUNK_SIZE; }
+
+  // Position of the first match in 'hay' of a needle 'needle_size' long, where
+  // find(view) returns the first match within 'view' (or npos).  Each chunk
+  // also covers the first needle_size-1 bytes of the next one, so matches
+  // that straddle a boundary are seen; chunks that start after a match that
+  // has already been found are skipped.
+  template <typename FIND_T>
+  size_t Find(std::string_view hay, size_t needle_size, FIND_T find,
+              ThreadPool * pool = nullptr) {
+    constexpr size_t npos = std::string_view::npos;
+    if (hay.size() < MIN_BYTES || needle_size == 0 || needle_size > CHUNK_SIZE) return find(hay);
+    if (!pool) pool = &ThreadPool::Shared();
+    if (pool->Size() == 1) return find(hay);
+    std::atomic<size_t> first{npos};
+    pool->ParallelFor(NumChunks(hay.size()), [&](size_t chunk, size_t) {
+      const size_t start = chunk * CHUNK_SIZE;
+      if (start > first.load(std::memory_order_relaxed)) return;
+      const size_t pos = find(hay.substr(start, CHUNK_SIZE + needle_size - 1));
+      if (pos == npos) return;
+      size_t best = first.load(std::memory_order_relaxed);
+      while (start + pos < best &&
+             !first.compare_exchange_weak(best, start + pos, std::memory_order_relaxed)) { }
+    });
+    return first.load();
+  }
+
+  // memcpy() for non-overlapping ranges, split across the pool when large.
+  inline void Copy(char * out, const char * in, size_t bytes,
+                   ThreadPool * pool = nullptr) {
+    if (bytes >= MIN_BYTES && !pool) pool = &ThreadPool::Shared();
+    if (bytes < MIN_BYTES || pool->Size() == 1) {
+      std::memcpy(out, in, bytes);
+      return;
+    }
+    pool->ParallelFor(NumChunks(bytes), [&](size_t chunk, size_t) {
+      const size_t start = chunk * CHUNK_SIZE;
+      std::memcpy(out + start, in + start, std::min(CHUNK_SIZE, bytes - start));
+    });
+  }
+}
@@ -1,95 +1,295 @@
 // -- Some header files that are likely to be useful --
 #include <assert.h>
+#include <deque>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 //#include <memory>
 
 //#include "AST.hpp"          // Build file for Abstract Syntax Tree nodes
+#include "AllocCounter.hpp"    // Opt-in heap allocation counting (make allocs)
+#include "Checkpoint.hpp"      // Snapshots of a running program (--checkpoint-every, --restore)
+#include "Compress.hpp"        // LZ codec for values that have gone cold (--compress-cold)
+#include "Diagnostic.hpp"      // Structured errors thrown by the interpreter.
+#include "ExprCache.hpp"       // Reuse of repeated subexpressions (--no-cse to disable)
 #include "helpers.hpp"         // A place to put useful helper functions.
+#include "Input.hpp"           // Streaming line reader for READ
+#include "Jit.hpp"             // Machine code for hot WHILE loops (--jit)
 #include "lexer.hpp"        // Auto-generate file from Emplex
+#include "Limits.hpp"          // Execution budgets (--max-steps, --max-memory, --timeout)
+#include "Output.hpp"          // Gathered writes and a background writer for PRINT output
+#include "Parallel.hpp"        // Multi-threaded search and copy for very large values
+#include "Search.hpp"          // Substring search for -, /, % and ?
+#include "Stats.hpp"           // Runtime statistics (--stats)
+#include "ThreadPool.hpp"      // Worker threads for --jobs
+#include "Trace.hpp"           // Opt-in execution tracing (make trace)
+#include "Watch.hpp"           // Re-running on file changes (--watch)
+#include "Value.hpp"           // Copy-on-write string values
 //#include "SymbolTable.hpp"  // Build file for your own Symbol Table
 
 using emplex::Lexer;        // Simplify use of Lexer and Token types.
 using emplex::Token;
 
 class StringStackPlusPlus {
+public:
+  static constexpr size_t DEFAULT_MAX_DEPTH = 100000;   // Block and '(' nesting
+  static constexpr size_t DEFAULT_JIT_THRESHOLD = 100;  // Loop iterations before compiling (--jit-threshold)
+  static constexpr size_t JIT_ALWAYS = 0;               // Compile loops before they first run (--jit)
+  static constexpr size_t JIT_NEVER = SIZE_MAX;         // Always interpret (--no-jit)
+  static constexpr size_t COLD_MIN_SIZE = 64 * 1024;    // Smallest value --compress-cold compresses
+
 private:
   const std::string filename;
   Lexer lexer;
 
-  std::vector<std::string> stack;
+  std::vector<Value> stack;
   //std::unordered_map<std::string, std::string> symbol_table;
-  std::vector<std::unordered_map<std::string, std::string>> symbol_stack;
-  std::unordered_map<std::string, int> symbolDeclarationLines;
+  // Variable names are looked up straight from token lexemes (string_views
+  // into the source), so the tables accept string_view keys for lookup.
+  struct NameHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+  };
+  template <typename T>
+  using NameMap = std::unordered_map<std::string, T, NameHash, std::equal_to<>>;
+
+  std::vector<NameMap<Value>> symbol_stack;
+  NameMap<int> symbolDeclarationLines;
 
 
 
   bool lastIfCondition = false;
   bool justProcessedIf = false;
 
+  // === Control flow ===
+  // Open blocks are tracked on an explicit stack instead of the C++ call
+  // stack, so nesting depth is bounded by max_depth rather than by recursion.
+  enum class FrameType { SCOPE, IF, ELSE, WHILE };
+
+  struct Frame {
+    FrameType type;
+    Token token;              // Token that opened the block (for errors)
+    size_t cond_pos = 0;      // WHILE: token index of the condition
+    size_t end_pos = 0;       // WHILE: token index after the '}' (0 until first seen)
+    uint64_t iterations = 0;  // WHILE: iterations started so far
+  };
+
+  std::vector<Frame> frames;
+  size_t max_depth = DEFAULT_MAX_DEPTH;
+  bool inlineStatement = false;   // Next statement is a single-line IF/ELSE body
+
+  // === Budgets ===
+  // Checked together at each WHILE backedge; a limit of SIZE_MAX never trips.
+  Limits limits;
+  size_t step_limit = SIZE_MAX;
+  size_t memory_limit = SIZE_MAX;
+  Watchdog watchdog;
+
+  stats::Counters counters;          // Reported by --stats
+
+  // === Checkpoints (--checkpoint-every) ===
+  // Taken between statements, whenever the checkpointer thread says one is due.
+  std::string checkpoint_path;
+  double checkpoint_every = 0.0;     // Seconds; 0 means never
+  uint64_t source_hash = 0;          // Of the program, recorded in each checkpoint
+  std::unique_ptr<checkpoint::Checkpointer> checkpointer;
+
+  search::NeedleCache needles;   // Preprocessed needles for repeated searches
+
+  LineReader input;              // Standard input, for READ
+
+  // ParseExpr's stacks, kept between calls so evaluating an expression
+  // doesn't allocate them anew each time.
+  std::vector<Value> expr_values;
+  std::vector<ExprCache::Operand> expr_operands;  // What each of expr_values came from
+  std::vector<Token> expr_ops;   // Pending operators and unclosed '('
+
+  ExprCache cse;                 // Results of operators in the current straight-line code
+  bool use_cse = true;
+
+  std::ostream * output = &std::cout;   // Where PRINT writes
+
+  // PRINT of variables and literals joined by '+' writes the pieces where
+  // they are stored rather than concatenating them; pieces adding up to at
+  // least WRITEV_MIN_BYTES bypass the stream buffer with one writev().
+  static constexpr size_t WRITEV_MIN_BYTES = 64 * 1024;
+  std::vector<std::string_view> print_pieces;
+
+  // === Parallel execution (--jobs) ===
+  // A run of simple top-level statements (VAR, assignments and PRINTs of an
+  // expression) is split into groups that share no variables.  Each group
+  // runs in order on a worker copy of the interpreter, and the output of
+  // every statement is then written out in program order.
+  static constexpr size_t MIN_PARALLEL_STATEMENTS = 8;
+  static constexpr size_t MAX_SERIAL_PREFIX = 4;   // Setup statements run first (see RunParallelRange)
+
+  struct ParallelGroup {
+    std::vector<size_t> statements;          // Indices into the range, in order
+    std::vector<std::string_view> names;     // Variables its statements mention
+    NameMap<Value> scope;                    // Those variables once it has run
+    NameMap<int> declaration_lines;
+    stats::Counters counters;
+  };
+
+  struct ParallelStatement {
+    size_t start;                            // Token index of its first token...
+    size_t end;                              // ...and of the newline ending it
+    std::string output;
+    std::optional<Diagnostic> error;
+  };
+
+  struct WorkerTag { };
+
+  size_t jobs = 1;
+  std::unique_ptr<ThreadPool> pool;
+  std::vector<std::unique_ptr<StringStackPlusPlus>> workers;   // One per pool worker
+  size_t serial_until = 0;       // No range before this token index is worth running in parallel
+  std::vector<ParallelStatement> parallel_statements;   // Statements of the range being run
+
+  // === Compiled loops (--jit) ===
+  // Loops start out interpreted.  Once a WHILE loop has run jit_threshold
+  // iterations (in one run, or over several), it is compiled to machine code
+  // (see Jit.hpp) in which each statement is a few direct calls to the Jit*
+  // helpers, with every variable already looked up.  A loop that gets hot
+  // part way through switches over at its backedge and carries on from
+  // there; later runs start compiled.  Only assignments, PRINT, READ, IF/ELSE
+  // and nested WHILE loops are compiled; a loop containing anything else
+  // stays interpreted, as does one that repeats an operation in
+  // straight-line code (unless --no-cse is given), since compiled code
+  // can't reuse results.  Statements are counted and budgets checked exactly as the
+  // interpreter does.
+  struct JitTest {                     // [!] left [op right], or [!] READ target
+    int op = 0;                        // Comparison token ID, ID_READ, or 0 for a bare operand
+    bool negate = false;
+    const Value * left = nullptr;
+    const Value * right = nullptr;
+    Value * target = nullptr;
+  };
+
+  struct JitPrint {                    // PRINT [!] a + b + ...
+    std::vector<const Value *> pieces;
+    bool reverse = false;
+  };
+
+  struct JitBackedge {                 // The '}' at the end of a loop body
+    Token token;                       // The loop's WHILE (for budget errors)
+    size_t pos;                        // Token index of the '}'
+    std::vector<const Frame *> frames; // Blocks open there, as the interpreter would have them
+  };
+
+  struct CompiledLoop {
+    jit::Code code;
+    std::vector<std::pair<std::string_view, Value *>> variables;   // As looked up when compiled
+    std::deque<Value> values;          // Literals and temporaries
+    std::deque<JitTest> tests;
+    std::deque<JitPrint> prints;
+    std::deque<Frame> frames;
+    std::deque<JitBackedge> backedges;
+    size_t depth = 0;                  // Most blocks open at once, counting the loop itself
+    size_t end_pos = 0;                // Token index after the loop's '}'
+  };
+
+  struct LoopTier {
+    uint64_t iterations = 0;           // Interpreted so far, in runs that have finished
+    bool rejected = false;             // It can't be compiled
+    std::unique_ptr<CompiledLoop> compiled;
+  };
+
+  static constexpr size_t JIT_MAX_NESTING = 64;   // Deeper blocks or parentheses are interpreted
+
+  size_t jit_threshold = DEFAULT_JIT_THRESHOLD;   // JIT_ALWAYS, JIT_NEVER, or iterations
+  std::unordered_map<size_t, LoopTier> jit_loops; // By token index of the loop's condition
+  const JitBackedge * jit_stop = nullptr;         // Where compiled code ran out of budget
+
+  // === Cold values (--compress-cold) ===
+  // Every cold_after statements, variables of COLD_MIN_SIZE bytes or more
+  // that haven't been used since the last sweep are compressed and emptied.
+  // Using one again (through IDToString or FindVariable) restores it first.
+  // Compressed copies are kept by the address of the variable's storage, and
+  // dropped when its scope closes.
+  struct ColdValue {
+    Value packed;                      // Counted in Value::LiveBytes like any other
+    size_t size;
+  };
+  size_t cold_after = 0;               // Statements; 0 never compresses
+  uint64_t next_sweep = 0;             // Statement count of the next sweep
+  std::unordered_map<const Value *, ColdValue> cold;
+  std::unordered_set<const Value *> used_since_sweep;   // Large variables only
+  std::unordered_map<const Value *, std::pair<const char *, size_t>> incompressible;   // Data and size when tried
+  size_t cold_saved = 0;               // Bytes saved by the values compressed now
+
   // === Helper Functions ===
 
   // A generic Error function that will provide a custom error for a given token.
+  // Errors are thrown as a Diagnostic; nothing is printed here so that output
+  // written so far can be flushed first by whoever catches it.
   template <typename... Ts>
-  void Error(Token token, Ts... message) {
-    // Print the beginning of all error messages:
-    std::cerr << "ERROR (line " << token.line_id << "): ";
-
-    // Print out all of the other arguments as the main message.
-    (std::cerr << ... << std::forward<Ts>(message));
-    std::cerr << std::endl;
+  [[noreturn]] void Error(const Token & token, Ts... message) {
+    ThrowDiagnostic(DiagnosticKind::Syntax, token.line_id, token.column,
+                    std::forward<Ts>(message)...);
+  }
 
-    exit(1); // Exit with a non-zero exit code.
+  // Same as Error, but for statements that parsed fine and failed while running.
+  template <typename... Ts>
+  [[noreturn]] void RuntimeError(const Token & token, Ts... message) {
+    ThrowDiagnostic(DiagnosticKind::Runtime, token.line_id, token.column,
+                    std::forward<Ts>(message)...);
   }
 
   // An easy way to throw an Unexpected Token error
-  void UnexpectedToken(Token token) {
+  [[noreturn]] void UnexpectedToken(const Token & token) {
     Error(token, "Unexpected token '", token.lexeme, "'");
   }
 
   // Determine if the current line has more arguments to process.
   bool HasArg() {
-    return lexer.Any() && lexer.Peek() != Lexer::ID_NEWLINE;
+    return lexer.Any() && lexer.PeekId() != Lexer::ID_NEWLINE;
   }
 
   // Pop the top value off of the internal stack.
-  std::string StackPop(const Token & token) {
-    if (stack.size() == 0) Error(token, "Stack underflow");
-    std::string out = stack.back();
+  Value StackPop(const Token & token) {
+    if (stack.size() == 0) RuntimeError(token, "Stack underflow");
+    Value out = std::move(stack.back());
     stack.pop_back();
     return out;
   }
 
   // Convert an ID token into the string value it represents.
-  std::string IDToString(const Token & token) {
+  // Returns a reference to the stored value, so reading a variable never copies.
+  const Value & IDToString(const Token & token) {
     assert(token == Lexer::ID_ID);
-    const std::string var_name = token.lexeme;
+    const std::string_view var_name = token.lexeme;
     /*if (symbol_table.find(var_name) == symbol_table.end()) {
-      Error(token, "Unknown variable '", var_name, "'");
+      RuntimeError(token, "Unknown variable '", var_name, "'");
     }
     return symbol_table[var_name];*/
     for (auto scope_it = symbol_stack.rbegin(); scope_it != symbol_stack.rend(); ++scope_it) {
-      auto &scope = *scope_it;
-      if (scope.find(var_name) != scope.end()) {
-        return scope[var_name];
+      auto it = scope_it->find(var_name);
+      if (it != scope_it->end()) {
+        if (cold_after) Touch(it->second);
+        trace::Read(token.line_id, var_name, it->second);
+        return it->second;
       }
     }
-    Error(token, "Unknown variable '", var_name, "'");
-    return "";
+    RuntimeError(token, "Unknown variable '", var_name, "'");
   }
 
   // Convert a literal string token into the string value it represents.
-  std::string LiteralToString(const Token & token) {
+  Value LiteralToString(const Token & token) {
     // Simple version: cut off both ends.
     // (A more complex version would translate escape characters)
-    return token.lexeme.substr(1, token.lexeme.size()-2);
+    return Value(token.lexeme.substr(1, token.lexeme.size()-2));
   }
 
   // Translate a particular token to a string.
-  std::string TokenToString(const Token & token) {
+  Value TokenToString(const Token & token) {
     // If we have a variable name, get its contents.
     if (token == Lexer::ID_ID) return IDToString(token);
 
@@ -103,7 +303,37 @@ private:
 
     // Otherwise we have an unexpected token!
     UnexpectedToken(token);
-    return "";
+  }
+
+  // Value of an ID or literal operand without copying variables: literals are
+  // converted into 'storage' and a reference to it is returned.
+  const Value & Operand(const Token & token, Value & storage) {
+    if (token == Lexer::ID_ID) return IDToString(token);
+    storage = TokenToString(token);
+    return storage;
+  }
+
+  // Position of the first 'needle' in 'hay' (search::npos if absent).
+  size_t Find(const Value & hay, std::string_view needle) {
+    if (const SubstringIndex * index = hay.SearchIndex()) {
+      const size_t pos = index->Find(hay, needle);
+      if (pos != SubstringIndex::UNKNOWN) return pos;
+    }
+    return Scan(hay, needle);
+  }
+
+  // Does 'needle' occur anywhere in 'hay'?
+  bool Contains(const Value & hay, std::string_view needle) {
+    if (const SubstringIndex * index = hay.SearchIndex()) return index->Contains(hay, needle);
+    return Scan(hay, needle) != search::npos;
+  }
+
+  // First 'needle' in 'hay' by scanning; very large values are split across threads.
+  size_t Scan(std::string_view hay, std::string_view needle) {
+    if (hay.size() < parallel::MIN_BYTES) return needles.Find(hay, needle);
+    const search::Searcher searcher(needle);
+    return parallel::Find(hay, needle.size(),
+      [&](std::string_view chunk) { return searcher.Find(chunk); });
   }
 
   std::string TokenIDToString (const Token & token) {
@@ -138,106 +368,169 @@ private:
     }
   }
 
-  std::string ApplyOperator(const Token &op, const std::string &left, const std::string &right) {
-    std::string result = left;
-
+  // Apply 'op' to 'result' in place.  This only copies characters when
+  // 'result' shares its storage with another Value (such as a variable).
+  void ApplyOperator(const Token &op, Value &result, const Value &right) {
     switch (op.id) {
       case Lexer::ID_PLUS: {
-        result += right;
+        ++counters.operators[stats::PLUS];
+        result.Append(right);
         break;
       }
       case Lexer::ID_MINUS: {
-        size_t pos = result.find(right);
+        ++counters.operators[stats::MINUS];
+        size_t pos = Find(result, right);
         if (pos != std::string::npos) {
-          result.erase(pos, right.length());
+          result.Erase(pos, right.size());
         }
         break;
       }
       case Lexer::ID_SLASH: {
-        size_t pos = result.find(right);
+        ++counters.operators[stats::SLASH];
+        size_t pos = Find(result, right);
         if (pos != std::string::npos) {
-          result = result.substr(0, pos);
+          result.Truncate(pos);
         }
         break;
       }
       case Lexer::ID_PERCENT: {
-        size_t pos = result.find(right);
+        ++counters.operators[stats::PERCENT];
+        size_t pos = Find(result, right);
         if (pos != std::string::npos) {
-          result = result.substr(pos + right.length());
+          result.RemovePrefix(pos + right.size());
         }
         break;
       }
       default:
       Error(op, "Unknown operator");
     }
-    return result;
-  }
-
-  // Highest level: handles PLUS and MINUS (lowest precedence)
-  std::string ParseExpr(const Token &first) {
-    std::string left = ParseTerm(first);
-    while (lexer.Any() && (lexer.Peek() == Lexer::ID_PLUS || lexer.Peek() == Lexer::ID_MINUS)) {
-      Token op = lexer.Use();
-      if (!lexer.Any()) Error(op, "Expected value after operator");
-      Token next = lexer.Use();
-      std::string right = ParseTerm(next);
-      left = ApplyOperator(op, left, right);
-    }
-    return left;
   }
 
-  // High-level: handles SLASH and PERCENT
-  std::string ParseTerm(const Token &first) {
-    std::string left = ParsePrimary(first);
-
-    while (lexer.Any() && (lexer.Peek() == Lexer::ID_SLASH || lexer.Peek() == Lexer::ID_PERCENT)) {
-      Token op = lexer.Use();
-      if (!lexer.Any()) Error(op, "Expected value after operator");
-      Token next = lexer.Use();
-      std::string right = ParsePrimary(next);
-      left = ApplyOperator(op, left, right);
-    }
-    return left;
-  }
+  // Evaluate an expression of literals, variables, + - / % and parentheses.
+  // Operands and pending operators live on explicit stacks (shunting-yard)
+  // rather than the call stack, so deeply parenthesized input is safe.
+  // If 'seed' is given, it is used (moved from) as the value of 'first'.
+  Value ParseExpr(const Token &first, Value * seed = nullptr) {
+    std::vector<Value> & values = expr_values;
+    std::vector<ExprCache::Operand> & operands = expr_operands;
+    std::vector<Token> & ops = expr_ops;
+    values.clear();             // May hold leftovers from an expression that failed.
+    operands.clear();
+    ops.clear();
+    size_t open_parens = 0;
+
+    auto precedence = [](int op) {
+      return (op == Lexer::ID_SLASH || op == Lexer::ID_PERCENT) ? 2 : 1;
+    };
+    auto reduce = [&]() {
+      Value right = std::move(values.back());
+      values.pop_back();
+      ExprCache::Operand right_operand = operands.back();
+      operands.pop_back();
+      if (cse.Lookup(ops.back().id, operands.back(), right_operand, values.back())) {
+        ++counters.reused_results;
+      } else {
+        ApplyOperator(ops.back(), values.back(), right);
+        cse.Remember(ops.back().id, operands.back(), right_operand, values.back());
+      }
+      ops.pop_back();
+    };
 
-  // Base-level: just handles a literal or variable
-  std::string ParsePrimary(const Token &token) {
-    if (token == Lexer::ID_ID || token == Lexer::ID_LIT_STRING) {
-      return TokenToString(token);
-    }
+    Token token = first;
+    while (true) {
+      // An operand, possibly behind some '('.
+      while (token == Lexer::ID_LPAREN) {
+        if (++open_parens > max_depth) {
+          RuntimeError(token, "Expression nested more than ", max_depth, " deep (see --max-depth)");
+        }
+        ops.push_back(token);
+        if (!lexer.Any()) Error(token, "Expected expression after '('");
+        token = lexer.Use();
+      }
+      if (token != Lexer::ID_ID && token != Lexer::ID_LIT_STRING) {
+        Error(token, "Unexpected token '", token.lexeme, "'");
+      }
+      if (seed) {
+        values.push_back(std::move(*seed));
+        operands.emplace_back();
+        seed = nullptr;
+      } else if (token == Lexer::ID_ID) {
+        const Value & var = IDToString(token);
+        values.push_back(var);
+        operands.push_back(use_cse ? ExprCache::Operand::Variable(var) : ExprCache::Operand{});
+      } else {
+        values.push_back(LiteralToString(token));
+        operands.push_back(use_cse ? ExprCache::Operand::Literal(token.lexeme) : ExprCache::Operand{});
+      }
 
-    if (token == Lexer::ID_LPAREN) {
-      if (!lexer.Any()) {
-        Error(token, "Expected expression after '('");
+      // Close any finished parentheses.
+      while (open_parens > 0 && lexer.PeekId() == Lexer::ID_RPAREN) {
+        while (ops.back() != Lexer::ID_LPAREN) reduce();
+        ops.pop_back();
+        --open_parens;
+        lexer.Skip();
       }
 
-      Token next = lexer.Use();
-      std::string value = ParseExpr(next);
+      // Continue if an operator follows.
+      const int next = lexer.PeekId();
+      if (next != Lexer::ID_PLUS && next != Lexer::ID_MINUS &&
+          next != Lexer::ID_SLASH && next != Lexer::ID_PERCENT) break;
+      while (!ops.empty() && ops.back() != Lexer::ID_LPAREN &&
+             precedence(ops.back()) >= precedence(next)) reduce();
+      ops.push_back(lexer.Use());
+      if (!lexer.Any()) Error(ops.back(), "Expected value after operator");
+      token = lexer.Use();
+    }
 
-      if (!lexer.Any() || lexer.Peek() != Lexer::ID_RPAREN) {
-        Error(token, "Missing parenthesis");
-      }
-      lexer.Use(); // consume ')'
-      return value;
+    if (open_parens > 0) {
+      auto unclosed = std::find_if(ops.rbegin(), ops.rend(),
+        [](const Token & op) { return op == Lexer::ID_LPAREN; });
+      Error(*unclosed, "Missing parenthesis");
     }
+    while (!ops.empty()) reduce();
+    return std::move(values.back());
+  }
 
-    Error(token, "Unexpected token '", token.lexeme, "'");
-    return "";
+  Value CompleteCalculation(const Token & token) {
+    return ParseExpr(token);
   }
 
+  // Is this assignment of the form "name = name <op> ..." with no other use of
+  // 'name' on the line?  'first' is the first token after '='.  If so, the
+  // variable's value can be moved out and updated in place.
+  bool IsSelfUpdate(std::string_view name, const Token & first) {
+    if (first != Lexer::ID_ID || first.lexeme != name) return false;
+    const int op = lexer.PeekId();
+    if (op != Lexer::ID_PLUS && op != Lexer::ID_MINUS &&
+        op != Lexer::ID_SLASH && op != Lexer::ID_PERCENT) return false;
+    for (size_t i = 1; lexer.PeekId(i) != Lexer::ID_NEWLINE && lexer.PeekId(i) != 0; ++i) {
+      if (lexer.PeekId(i) == Lexer::ID_ID && lexer.Peek(i).lexeme == name) return false;
+    }
+    return true;
+  }
 
-  std::string CompleteCalculation(const Token & token) {
-    Token current = token;
-    return ParseExpr(token);
+  // Which stats counter a comparison operator (already validated) goes to.
+  static stats::Comparison ComparisonKind(int op) {
+    switch (op) {
+      case Lexer::ID_EQ:  return stats::EQ;
+      case Lexer::ID_NEQ: return stats::NEQ;
+      case Lexer::ID_LT:  return stats::LT;
+      case Lexer::ID_LE:  return stats::LE;
+      case Lexer::ID_GT:  return stats::GT;
+      case Lexer::ID_GE:  return stats::GE;
+      default:            return stats::CONTAINS;
+    }
   }
 
   bool ParseExpression() {
     bool valid = false;
     bool notPresent = false;
     bool rightSide = false;
-    std::string leftValue;
-    std::string rightValue;
-    Token op;
+    Value leftLiteral;                  // Storage for operands that are literals;
+    Value rightLiteral;                 //   variables are read in place.
+    const Value * leftValue = &leftLiteral;
+    const Value * rightValue = &rightLiteral;
+    Token op{};
 
     // if token id is Lexer::ID_NOT
     Token current = lexer.Use();
@@ -249,17 +542,23 @@ private:
       current = lexer.Use();
     }
 
+    // READ as a condition is true while there is input left.
+    if (current == Lexer::ID_READ) {
+      valid = ProcessREAD(current);
+      return notPresent ? !valid : valid;
+    }
+
     // if token id is Lexer::ID_ID or token id is Lexer::ID_LIT_STRING
     if (current == Lexer::ID_ID || current == Lexer::ID_LIT_STRING) {
       // set left side variable to the value of the token
-      leftValue = TokenToString(current);
+      leftValue = &Operand(current, leftLiteral);
 
       // if token id is NOT Lexer::ID_RPAREN
-      if (lexer.Any() && lexer.Peek() != Lexer::ID_RPAREN) {
+      if (lexer.Any() && lexer.PeekId() != Lexer::ID_RPAREN) {
         rightSide = true;
 
         // if token id is an operator id
-        Token possible_op = lexer.Use();
+        const Token & possible_op = lexer.Use();
         switch (possible_op.id) {
           case Lexer::ID_EQ:
           case Lexer::ID_NEQ:
@@ -278,9 +577,9 @@ private:
         // if token id is Lexer::ID_ID or token id is Lexer::ID_LIT_STRING
         if (!lexer.Any()) Error(op, "Expected right-hand expression after operator");
         // set right side variable to the value of the token
-        Token right = lexer.Use();
+        const Token & right = lexer.Use();
         if (right == Lexer::ID_ID || right == Lexer::ID_LIT_STRING) {
-          rightValue = TokenToString(right);
+          rightValue = &Operand(right, rightLiteral);
         } else {
           Error(right, "Expected identifier or string literal after operator");
         }
@@ -291,20 +590,11 @@ private:
     }
 
     if (!rightSide) {
-      valid = !leftValue.empty();
+      ++counters.comparisons[stats::TRUTHY];
+      valid = !leftValue->empty();
     } 
     else {
-      // Compare leftValue and rightValue based on operator
-      if (op == Lexer::ID_EQ)        valid = (leftValue == rightValue);
-      else if (op == Lexer::ID_NEQ)  valid = (leftValue != rightValue);
-      else if (op == Lexer::ID_LT)   valid = (leftValue < rightValue);
-      else if (op == Lexer::ID_LE)   valid = (leftValue <= rightValue);
-      else if (op == Lexer::ID_GT)   valid = (leftValue > rightValue);
-      else if (op == Lexer::ID_GE)   valid = (leftValue >= rightValue);
-      else if (op == Lexer::ID_QUESTION) {
-        valid = (leftValue.find(rightValue) != std::string::npos);
-      }
-      else Error(op, "Unknown operator in expression");
+      valid = Compare(op, *leftValue, *rightValue);
     }
 
     if (notPresent) {
@@ -313,6 +603,862 @@ private:
     return valid;
   }
 
+  // Compare two values with a comparison operator (already validated).
+  bool Compare(int op, const Value & left, const Value & right) {
+    const std::string_view lhs = left, rhs = right;
+    ++counters.comparisons[ComparisonKind(op)];
+    switch (op) {
+      case Lexer::ID_EQ:  return lhs == rhs;
+      case Lexer::ID_NEQ: return lhs != rhs;
+      case Lexer::ID_LT:  return lhs < rhs;
+      case Lexer::ID_LE:  return lhs <= rhs;
+      case Lexer::ID_GT:  return lhs > rhs;
+      case Lexer::ID_GE:  return lhs >= rhs;
+      default:            return Contains(left, rhs);
+    }
+  }
+
+
+  // A worker for --jobs: same program and settings, its own state.
+  StringStackPlusPlus(WorkerTag, const StringStackPlusPlus & main)
+    : filename(main.filename), lexer(main.lexer), max_depth(main.max_depth), use_cse(main.use_cse) {
+    symbol_stack.push_back({});
+  }
+
+  // May this token appear inside a simple statement?
+  static bool IsSimpleStatementToken(int id) {
+    switch (id) {
+      case Lexer::ID_ID: case Lexer::ID_LIT_STRING: case Lexer::ID_ASSIGN: case Lexer::ID_NOT:
+      case Lexer::ID_PLUS: case Lexer::ID_MINUS: case Lexer::ID_SLASH: case Lexer::ID_PERCENT:
+      case Lexer::ID_LPAREN: case Lexer::ID_RPAREN:
+      case Lexer::ID_EQ: case Lexer::ID_NEQ: case Lexer::ID_LT: case Lexer::ID_LE:
+      case Lexer::ID_GT: case Lexer::ID_GE: case Lexer::ID_QUESTION:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Run one group's statements on this worker, starting from the main
+  // interpreter's values of the variables they mention.
+  void RunGroup(const StringStackPlusPlus & main, ParallelGroup & group,
+                std::vector<ParallelStatement> & statements) {
+    symbol_stack.assign(1, {});
+    symbolDeclarationLines.clear();
+    cse.Clear();
+    counters = {};
+    for (std::string_view name : group.names) {
+      auto it = main.symbol_stack.back().find(name);
+      if (it == main.symbol_stack.back().end()) continue;
+      symbol_stack.back().emplace(it->first, it->second);
+      auto line_it = main.symbolDeclarationLines.find(name);
+      if (line_it != main.symbolDeclarationLines.end()) symbolDeclarationLines.emplace(*line_it);
+    }
+
+    std::ostringstream buffer;
+    output = &buffer;
+    for (size_t index : group.statements) {
+      ParallelStatement & statement = statements[index];
+      lexer.SetPos(statement.start);
+      try {
+        ProcessLine();
+      } catch (const Diagnostic & diag) {
+        statement.error = diag;
+      }
+      statement.output = std::move(buffer).str();
+      buffer.str({});
+      if (statement.error) break;      // The run stops here; later output is never used.
+    }
+    output = &std::cout;
+
+    group.scope = std::move(symbol_stack.back());
+    group.declaration_lines = std::move(symbolDeclarationLines);
+    counters.parallel_statements = counters.statements;
+    group.counters = counters;
+  }
+
+  // If a long enough run of independent simple statements starts here, run
+  // it on the worker threads and return true.
+  bool RunParallelRange() {
+    const size_t begin = lexer.GetPos();
+    if (begin < serial_until || symbol_stack.size() != 1) return false;
+    if constexpr (trace::enabled) {
+      if (trace::GetRing().Active()) return false;   // The trace buffer is not thread-safe.
+    }
+    auto id_at = [&](size_t pos) { return lexer.PeekId(pos - begin); };
+
+    // Find the statements.  Most runs are too short, so this first pass
+    // reuses its storage.
+    std::vector<ParallelStatement> & statements = parallel_statements;
+    statements.clear();
+    size_t pos = begin;
+    while (true) {
+      while (id_at(pos) == Lexer::ID_NEWLINE) ++pos;
+      const int first = id_at(pos);
+      if (first != Lexer::ID_VAR && first != Lexer::ID_ID && first != Lexer::ID_PRINT) break;
+      size_t end = pos + 1;
+      while (IsSimpleStatementToken(id_at(end))) ++end;
+      if (end == pos + 1 && first == Lexer::ID_PRINT) break;          // PRINT of the stack
+      if (id_at(end) != Lexer::ID_NEWLINE && id_at(end) != 0) break;  // Leave it to ProcessLine.
+      statements.push_back({ .start = pos, .end = end, .output = {}, .error = {} });
+      pos = end;
+    }
+
+    // Split statements [first, end) into groups: any two that mention the
+    // same variable join, unless none of them assigns it.
+    auto make_groups = [&](size_t first) {
+      std::unordered_set<std::string_view> assigned;
+      for (size_t index = first; index < statements.size(); ++index) {
+        for (size_t i = statements[index].start; i + 1 < statements[index].end; ++i) {
+          if (id_at(i) == Lexer::ID_ID && id_at(i + 1) == Lexer::ID_ASSIGN) assigned.insert(lexer.At(i).lexeme);
+        }
+      }
+      std::vector<size_t> parent(statements.size());            // Union-find forest
+      std::unordered_map<std::string_view, size_t> first_use;  // Variable -> statement
+      auto root = [&](size_t index) {
+        while (parent[index] != index) index = parent[index] = parent[parent[index]];
+        return index;
+      };
+      for (size_t index = first; index < statements.size(); ++index) {
+        parent[index] = index;
+        for (size_t i = statements[index].start; i < statements[index].end; ++i) {
+          if (id_at(i) != Lexer::ID_ID) continue;
+          const std::string_view name = lexer.At(i).lexeme;
+          if (!assigned.contains(name)) continue;
+          auto [it, added] = first_use.try_emplace(name, index);
+          if (!added) parent[root(index)] = root(it->second);
+        }
+      }
+      std::vector<ParallelGroup> groups;
+      std::vector<size_t> group_of(statements.size(), SIZE_MAX);
+      for (size_t index = first; index < statements.size(); ++index) {
+        size_t & group = group_of[root(index)];
+        if (group == SIZE_MAX) {
+          group = groups.size();
+          groups.emplace_back();
+        }
+        groups[group].statements.push_back(index);
+        for (size_t i = statements[index].start; i < statements[index].end; ++i) {
+          if (id_at(i) == Lexer::ID_ID) groups[group].names.push_back(lexer.At(i).lexeme);
+        }
+      }
+      return groups;
+    };
+
+    // Runs often start by setting up values that everything after them only
+    // reads, which would join every group; try running a few statements
+    // serially first.
+    std::vector<ParallelGroup> groups;
+    size_t serial = 0;
+    for (; serial <= MAX_SERIAL_PREFIX && statements.size() - serial >= MIN_PARALLEL_STATEMENTS; ++serial) {
+      groups = make_groups(serial);
+      if (groups.size() >= 2) break;
+    }
+    if (groups.size() < 2 || statements.size() - serial < MIN_PARALLEL_STATEMENTS) {
+      serial_until = std::max(pos, begin + 1);
+      return false;
+    }
+    while (lexer.GetPos() < statements[serial].start) ProcessLine();
+
+    // Workers read the variables straight from our scope.
+    if (!cold.empty()) {
+      for (const ParallelGroup & group : groups) for (std::string_view name : group.names) FindVariable(name);
+    }
+    if (!pool) pool = std::make_unique<ThreadPool>(jobs);
+    while (workers.size() < pool->Size()) {
+      workers.emplace_back(new StringStackPlusPlus(WorkerTag{}, *this));
+    }
+    pool->ParallelFor(groups.size(), [&](size_t group, size_t worker) {
+      workers[worker]->RunGroup(*this, groups[group], statements);
+    });
+
+    // If a statement failed, groups may have run past it, so none of their
+    // work is kept: the range is run again serially, up to the error, which
+    // leaves the output, variables and counts exactly as a serial run would.
+    for (size_t index = serial; index < statements.size(); ++index) {
+      if (!statements[index].error) continue;
+      serial_until = pos;
+      lexer.SetPos(statements[serial].start);
+      while (lexer.GetPos() < statements[index].end) ProcessLine();
+      throw *statements[index].error;
+    }
+
+    // Otherwise commit in program order.
+    for (size_t index = serial; index < statements.size(); ++index) *output << statements[index].output;
+    for (ParallelGroup & group : groups) {
+      for (auto & [name, value] : group.scope) symbol_stack.back().insert_or_assign(name, std::move(value));
+      for (auto & [name, line] : group.declaration_lines) symbolDeclarationLines.insert_or_assign(name, line);
+      counters += group.counters;
+    }
+    cse.Clear();
+    lexer.SetPos(pos);
+    return true;
+  }
+
+  // Hand the current state to the checkpointer.  Output printed so far is
+  // flushed first, so it is all out by the time the checkpoint is on disk.
+  void TakeCheckpoint() {
+    output->flush();
+    checkpoint::Snapshot snap{
+      .source_hash = source_hash,
+      .num_tokens = lexer.NumTokens(),
+      .pos = lexer.GetPos(),
+      .last_if_condition = lastIfCondition,
+      .just_processed_if = justProcessedIf,
+      .inline_statement = inlineStatement,
+      .stack = stack,
+      .scopes = {},
+      .declaration_lines = { symbolDeclarationLines.begin(), symbolDeclarationLines.end() },
+      .frames = {},
+      .counters = counters,
+    };
+    snap.scopes.reserve(symbol_stack.size());
+    for (const auto & scope : symbol_stack) {
+      auto & saved = snap.scopes.emplace_back();
+      saved.reserve(scope.size());
+      for (const auto & [name, value] : scope) {
+        auto it = cold.find(&value);   // Saved whole; the program's copy stays compressed.
+        saved.emplace_back(name, it == cold.end() ? value : Unpack(it->second));
+      }
+    }
+    snap.frames.reserve(frames.size());
+    for (const Frame & frame : frames) {
+      snap.frames.push_back({ .type = static_cast<uint64_t>(frame.type), .token_pos = lexer.PosOf(frame.token),
+                              .cond_pos = frame.cond_pos, .end_pos = frame.end_pos,
+                              .iterations = frame.iterations });
+    }
+    checkpointer->Submit(std::move(snap));
+  }
+
+  // Take over the state in 'snap', leaving it empty.  Moving the values
+  // matters: a copy left behind would share them, and make the program copy
+  // each one the first time it changed it.
+  void RestoreCheckpoint(checkpoint::Snapshot & snap) {
+    lexer.SetPos(snap.pos);
+    lastIfCondition = snap.last_if_condition;
+    justProcessedIf = snap.just_processed_if;
+    inlineStatement = snap.inline_statement;
+    stack = std::move(snap.stack);
+    symbol_stack.clear();
+    for (auto & scope : snap.scopes) {
+      symbol_stack.emplace_back(std::make_move_iterator(scope.begin()), std::make_move_iterator(scope.end()));
+    }
+    for (const auto & [name, line] : snap.declaration_lines) {
+      symbolDeclarationLines.emplace(name, static_cast<int>(line));
+    }
+    for (const checkpoint::Frame & frame : snap.frames) {
+      frames.push_back({ .type = static_cast<FrameType>(frame.type), .token = lexer.At(frame.token_pos),
+                         .cond_pos = frame.cond_pos, .end_pos = frame.end_pos,
+                         .iterations = frame.iterations });
+    }
+    counters = snap.counters;
+    snap = {};
+  }
+
+  // --- Compiled loops (--jit) ---
+
+  // Turns the tokens of one WHILE loop into machine code, reading them with
+  // the interpreter's own lexer (whose position is put back afterwards).
+  // Each method compiles one construct the way the interpreter would run
+  // it, and returns false for anything it doesn't handle.
+  class LoopCompiler {
+  private:
+    StringStackPlusPlus & interp;
+    Lexer & lexer;
+    CompiledLoop & loop;
+    jit::Assembler as;
+    const size_t start_pos;
+    size_t stop = 0;                   // Label of the exit taken when a budget runs out
+    uint32_t uncounted = 0;            // Statements run but not yet added to counters.statements
+    std::vector<const Frame *> open;   // Blocks open at this point, innermost last
+    std::vector<Value *> temps;        // Temporaries, reused by each statement
+    size_t temps_used = 0;
+    std::vector<std::string> computed; // Operations since the last control flow, for CSE
+
+    uint64_t Self() const { return reinterpret_cast<uint64_t>(&interp); }
+    template <typename T>
+    static uint64_t Arg(T * ptr) { return reinterpret_cast<uint64_t>(ptr); }
+
+    static bool IsComparison(int id) {
+      switch (id) {
+        case Lexer::ID_EQ: case Lexer::ID_NEQ: case Lexer::ID_LT: case Lexer::ID_LE:
+        case Lexer::ID_GT: case Lexer::ID_GE: case Lexer::ID_QUESTION:
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    // Add the statements run so far to the count.  This happens before every
+    // label and every test that may jump, so each path counts what it ran.
+    void Count() {
+      if (uncounted > 0) as.AddTo(&interp.counters.statements, uncounted);
+      uncounted = 0;
+    }
+    void Bind(size_t label) { Count(); as.Bind(label); }
+
+    bool Skip(int id) {
+      if (lexer.PeekId() != id) return false;
+      lexer.Skip();
+      return true;
+    }
+
+    // A statement must be followed by a newline or the '}' closing its block.
+    bool EndStatement() {
+      return lexer.PeekId() == Lexer::ID_RBRACE || Skip(Lexer::ID_NEWLINE);
+    }
+
+    Value * Variable(std::string_view name) {
+      Value * var = interp.FindVariable(name);
+      if (var && std::none_of(loop.variables.begin(), loop.variables.end(),
+                              [&](const auto & known) { return known.first == name; })) {
+        loop.variables.emplace_back(name, var);
+      }
+      return var;
+    }
+
+    // How ExprCache would identify the value of 'token' ("" if it wouldn't).
+    std::string OperandKey(const Token & token) {
+      if (!interp.use_cse) return {};
+      if (token == Lexer::ID_ID) {
+        return "v" + std::to_string(reinterpret_cast<uintptr_t>(interp.FindVariable(token.lexeme))) + ";";
+      }
+      return "l" + std::to_string(token.lexeme.size()) + ":" + std::string(token.lexeme);
+    }
+
+    // Note that 'left op right' is computed, making 'left' its key.  False if
+    // it was already computed in this stretch of code: the interpreter would
+    // reuse the result, so the loop is better left to it.
+    bool Computed(int op, std::string & left, const std::string & right) {
+      if (left.empty() || right.empty()) { left.clear(); return true; }
+      left = "(" + left + std::to_string(op) + right + ")";
+      if (std::find(computed.begin(), computed.end(), left) != computed.end()) return false;
+      computed.push_back(left);
+      return true;
+    }
+
+    // 'target' changed: forget what was computed from it.
+    void Changed(const Token & target) {
+      const std::string key = OperandKey(target);
+      std::erase_if(computed, [&](const std::string & op) { return op.find(key) != std::string::npos; });
+    }
+
+    // A variable or literal, where its value is stored; nullptr for anything else.
+    const Value * Operand(const Token & token) {
+      if (token == Lexer::ID_ID) return Variable(token.lexeme);
+      if (token == Lexer::ID_LIT_STRING) return &loop.values.emplace_back(interp.LiteralToString(token));
+      return nullptr;
+    }
+
+    Value * Temp() {
+      if (temps_used == temps.size()) temps.push_back(&loop.values.emplace_back());
+      return temps[temps_used++];
+    }
+
+    Frame * OpenBlock(Frame frame) {
+      if (open.size() >= JIT_MAX_NESTING) return nullptr;
+      Frame & added = loop.frames.emplace_back(std::move(frame));
+      open.push_back(&added);
+      loop.depth = std::max(loop.depth, open.size());
+      return &added;
+    }
+
+    // A condition, as ParseExpression reads it.
+    const JitTest * Condition() {
+      JitTest test;
+      test.negate = Skip(Lexer::ID_NOT);
+      if (Skip(Lexer::ID_READ)) {
+        test.op = Lexer::ID_READ;
+        if (lexer.PeekId() != Lexer::ID_ID) return nullptr;
+        test.target = Variable(lexer.Use().lexeme);
+        if (!test.target) return nullptr;
+      } else {
+        test.left = Operand(lexer.Use());
+        if (!test.left) return nullptr;
+        if (lexer.PeekId() != Lexer::ID_RPAREN) {
+          test.op = lexer.PeekId();
+          if (!IsComparison(test.op)) return nullptr;
+          lexer.Skip();
+          test.right = Operand(lexer.Use());
+          if (!test.right) return nullptr;
+        }
+      }
+      return &loop.tests.emplace_back(test);
+    }
+
+    // Evaluate 'test', leaving the result in al.
+    void Test(const JitTest * test) {
+      Count();
+      as.Call(&JitCondition, { Self(), Arg(test) });
+    }
+
+    // The expression at the lexer, left in 'result': ParseExpr's grammar,
+    // read by recursive descent.  If 'seed' is given it is the first
+    // operand, moved out of its variable rather than copied.  'key' is set
+    // to the expression's key for CSE.
+    bool Expression(Value * result, Value * seed, size_t depth, std::string & key) {
+      if (!Term(result, seed, depth, key)) return false;
+      while (lexer.PeekId() == Lexer::ID_PLUS || lexer.PeekId() == Lexer::ID_MINUS) {
+        if (!Apply(lexer.Use().id, result, depth, false, key)) return false;
+      }
+      return true;
+    }
+
+    bool Term(Value * result, Value * seed, size_t depth, std::string & key) {
+      if (!Primary(result, seed, depth, key)) return false;
+      while (lexer.PeekId() == Lexer::ID_SLASH || lexer.PeekId() == Lexer::ID_PERCENT) {
+        if (!Apply(lexer.Use().id, result, depth, true, key)) return false;
+      }
+      return true;
+    }
+
+    bool Primary(Value * result, Value * seed, size_t depth, std::string & key) {
+      const Token token = lexer.Use();
+      if (token == Lexer::ID_LPAREN) {
+        if (++depth > std::min(interp.max_depth, JIT_MAX_NESTING)) return false;
+        return Expression(result, seed, depth, key) && Skip(Lexer::ID_RPAREN);
+      }
+      if (seed && token == Lexer::ID_ID) {
+        key.clear();
+        as.Call(&JitTake, { Arg(result), Arg(seed) });
+        return true;
+      }
+      const Value * value = Operand(token);
+      if (!value) return false;
+      key = OperandKey(token);
+      as.Call(&JitCopy, { Arg(result), Arg(value) });
+      return true;
+    }
+
+    // Apply 'op' (just used) to 'result'.  A right-hand side that is a lone
+    // variable or literal is used where it is stored; anything else is
+    // evaluated into a temporary first.  'high' is true for / and %.
+    bool Apply(int op, Value * result, size_t depth, bool high, std::string & key) {
+      const int first = lexer.PeekId(), next = lexer.PeekId(1);
+      if ((first == Lexer::ID_ID || first == Lexer::ID_LIT_STRING) &&
+          (high || (next != Lexer::ID_SLASH && next != Lexer::ID_PERCENT))) {
+        const Token token = lexer.Use();
+        const Value * right = Operand(token);
+        if (!right || !Computed(op, key, OperandKey(token))) return false;
+        as.Call(&JitApply, { Self(), static_cast<uint64_t>(op), Arg(result), Arg(right) });
+        return true;
+      }
+      Value * temp = Temp();
+      std::string right_key;
+      if (!(high ? Primary(temp, nullptr, depth, right_key) : Term(temp, nullptr, depth, right_key)) ||
+          !Computed(op, key, right_key)) {
+        return false;
+      }
+      as.Call(&JitApply, { Self(), static_cast<uint64_t>(op), Arg(result), Arg(temp) });
+      as.Call(&JitClear, { Arg(temp) });
+      return true;
+    }
+
+    bool Assign(const Token & token) {
+      Value * target = Variable(token.lexeme);
+      if (!target || !Skip(Lexer::ID_ASSIGN)) return false;
+      const bool negate = Skip(Lexer::ID_NOT);
+      if (!lexer.Any()) return false;
+      const Token first = lexer.Use();
+      const bool self_update = interp.IsSelfUpdate(token.lexeme, first);
+      lexer.SetPos(lexer.GetPos() - 1);
+      Value * result = Temp();
+      std::string key;
+      if (!Expression(result, self_update ? target : nullptr, 0, key)) return false;
+      as.Call(&JitStore, { Arg(result), Arg(target), negate });
+      Changed(token);
+      return true;
+    }
+
+    bool Print() {
+      if (!lexer.Any() || lexer.PeekId() == Lexer::ID_NEWLINE) return false;   // Pops the stack
+      const bool reverse = Skip(Lexer::ID_NOT);
+      if (const size_t length = interp.PiecesLength()) {
+        JitPrint & print = loop.prints.emplace_back();
+        print.reverse = reverse;
+        for (size_t i = 0; i < length; i += 2) {
+          print.pieces.push_back(Operand(lexer.Use()));
+          if (!print.pieces.back()) return false;
+          if (i + 1 < length) lexer.Skip();   // '+'
+        }
+        as.Call(&JitPrintPieces, { Self(), Arg(&print) });
+        return true;
+      }
+      const int next = lexer.PeekId(1);
+      if (lexer.PeekId() == Lexer::ID_LPAREN && IsComparison(lexer.PeekId(2)) &&
+          (next == Lexer::ID_ID || next == Lexer::ID_LIT_STRING)) {
+        lexer.Skip();
+        const JitTest * test = Condition();
+        if (!test || !Skip(Lexer::ID_RPAREN)) return false;
+        as.Call(&JitPrintTest, { Self(), Arg(test), reverse });
+        return true;
+      }
+      Value * value = Temp();
+      std::string key;
+      if (!Expression(value, nullptr, 0, key)) return false;
+      as.Call(&JitPrintValue, { Self(), Arg(value), reverse });
+      return true;
+    }
+
+    bool Read() {
+      if (lexer.PeekId() != Lexer::ID_ID) return false;
+      const Token token = lexer.Use();
+      Value * target = Variable(token.lexeme);
+      if (!target) return false;
+      as.Call(&JitRead, { Self(), Arg(target) });
+      Changed(token);
+      return true;
+    }
+
+    // An assignment, PRINT or READ, whose first token 'token' has been used.
+    bool Statement(const Token & token) {
+      temps_used = 0;
+      switch (token) {
+        case Lexer::ID_ID:    return Assign(token) && EndStatement();
+        case Lexer::ID_PRINT: return Print() && EndStatement();
+        case Lexer::ID_READ:  return Read() && EndStatement();
+        default:              return false;
+      }
+    }
+
+    // The block or single statement after IF (...) or ELSE, which runs
+    // unless the jump around it was taken.
+    bool Branch(const Token & token, FrameType type) {
+      if (!Skip(Lexer::ID_LBRACE)) {
+        const int id = lexer.PeekId();
+        if (id != Lexer::ID_ID && id != Lexer::ID_PRINT && id != Lexer::ID_READ) return false;
+        ++uncounted;
+        return Statement(lexer.Use());
+      }
+      if (!OpenBlock({ .type = type, .token = token }) || !Block()) return false;
+      lexer.Skip();                    // '}'
+      ++uncounted;
+      open.pop_back();
+      as.Store(&interp.justProcessedIf, type == FrameType::IF);
+      if (type == FrameType::IF) as.Store(&interp.lastIfCondition, true);
+      return EndStatement();
+    }
+
+    bool If(const Token & token) {
+      if (!Skip(Lexer::ID_LPAREN)) return false;
+      const JitTest * test = Condition();
+      if (!test || !Skip(Lexer::ID_RPAREN)) return false;
+      Test(test);
+      as.StoreResult(&interp.lastIfCondition);
+      as.Store(&interp.justProcessedIf, true);
+      const size_t skip = as.NewLabel();
+      as.JumpIfFalse(skip);
+      if (!Branch(token, FrameType::IF)) return false;
+      Bind(skip);
+      return true;
+    }
+
+    bool Else(const Token & token) {
+      Count();
+      as.Store(&interp.justProcessedIf, false);
+      as.Load(&interp.lastIfCondition);
+      const size_t skip = as.NewLabel();
+      as.JumpIfTrue(skip);
+      if (!Branch(token, FrameType::ELSE)) return false;
+      Bind(skip);
+      return true;
+    }
+
+    // A loop, with the lexer just past its WHILE.  The outermost one leaves
+    // the end of its statement to the interpreter.
+    bool While(const Token & token, bool outermost) {
+      if (!Skip(Lexer::ID_LPAREN)) return false;
+      const size_t cond_pos = lexer.GetPos();
+      const JitTest * test = Condition();
+      if (!test || !Skip(Lexer::ID_RPAREN) || !Skip(Lexer::ID_LBRACE)) return false;
+      Frame * frame = OpenBlock({ .type = FrameType::WHILE, .token = token, .cond_pos = cond_pos,
+                                  .iterations = 1 });
+      if (!frame) return false;
+
+      const size_t body = as.NewLabel(), done = as.NewLabel();
+      Test(test);
+      as.JumpIfFalse(done);
+      Bind(body);
+      if (!Block()) return false;
+      const size_t close_pos = lexer.GetPos();
+      lexer.Skip();                    // '}'
+      frame->end_pos = lexer.GetPos();
+      Count();
+      const JitBackedge & edge = loop.backedges.emplace_back(JitBackedge{ token, close_pos, open });
+      as.Call(&JitLoopBack, { Self(), Arg(&edge) });
+      as.JumpIfTrue(stop);
+      Test(test);
+      as.JumpIfTrue(body);
+      open.pop_back();
+      Bind(done);
+
+      if (outermost) {
+        loop.end_pos = frame->end_pos;
+        return true;
+      }
+      return EndStatement();
+    }
+
+    // The statements of a block, up to (but not including) its '}'.
+    bool Block() {
+      bool after_if = false;           // May an ELSE come next?
+      while (true) {
+        const int next = lexer.PeekId();
+        if (next == Lexer::ID_RBRACE) return true;
+        if (next == Lexer::ID__EOF_) return false;
+        if (next == Lexer::ID_NEWLINE) { lexer.Skip(); continue; }
+
+        const Token token = lexer.Use();
+        ++uncounted;
+        bool ok = false;
+        const bool control = token == Lexer::ID_IF || token == Lexer::ID_ELSE || token == Lexer::ID_WHILE;
+        if (control) computed.clear();   // As the interpreter clears its cache
+        switch (token) {
+          case Lexer::ID_IF:    ok = If(token); break;
+          case Lexer::ID_ELSE:  ok = after_if && Else(token); break;
+          case Lexer::ID_WHILE: ok = While(token, false); break;
+          default:              ok = Statement(token); break;
+        }
+        if (!ok) return false;
+        if (control) computed.clear();
+        after_if = token == Lexer::ID_IF;
+      }
+    }
+
+  public:
+    LoopCompiler(StringStackPlusPlus & in_interp, CompiledLoop & in_loop)
+      : interp(in_interp), lexer(in_interp.lexer), loop(in_loop), start_pos(lexer.GetPos()) { }
+    ~LoopCompiler() { lexer.SetPos(start_pos); }
+
+    // Compile the loop opened by 'token' whose condition starts at token
+    // index 'cond_pos'.  Its code starts by testing the condition, returns 0
+    // once the loop is done, or 1 if a budget ran out (leaving the backedge
+    // in jit_stop).
+    bool Compile(const Token & token, size_t cond_pos) {
+      stop = as.NewLabel();
+      lexer.SetPos(cond_pos - 1);
+      if (!While(token, true)) return false;
+      as.Return(0);
+      as.Bind(stop);
+      as.Return(1);
+      loop.code = jit::Code(as.Finish());
+      return loop.code.Ok();
+    }
+  };
+
+  // Helpers called from compiled code.  Exceptions must not pass through
+  // it, so none of these throw (short of running out of memory).
+
+  static bool JitCondition(StringStackPlusPlus * self, const JitTest * test) {
+    bool result = false;
+    switch (test->op) {
+      case 0:
+        ++self->counters.comparisons[stats::TRUTHY];
+        result = !test->left->empty();
+        break;
+      case Lexer::ID_READ:
+        result = self->ReadLine(*test->target);
+        break;
+      default:
+        result = self->Compare(test->op, *test->left, *test->right);
+    }
+    return result != test->negate;
+  }
+
+  static void JitCopy(Value * result, const Value * value) { *result = *value; }
+  static void JitTake(Value * result, Value * variable) { *result = std::move(*variable); }
+  static void JitClear(Value * value) { value->Clear(); }
+
+  static void JitApply(StringStackPlusPlus * self, int op, Value * result, const Value * right) {
+    Token token{};
+    token.id = op;
+    self->ApplyOperator(token, *result, *right);
+  }
+
+  static void JitStore(Value * result, Value * target, bool negate) {
+    if (negate) *result = result->empty() ? "1" : "";
+    *target = std::move(*result);
+  }
+
+  static void JitRead(StringStackPlusPlus * self, Value * target) { self->ReadLine(*target); }
+
+  static void JitPrintValue(StringStackPlusPlus * self, Value * value, bool reverse) {
+    if (value->empty() && reverse) *value = "1";
+    *self->output << *value << '\n';
+    value->Clear();
+  }
+
+  static void JitPrintTest(StringStackPlusPlus * self, const JitTest * test, bool reverse) {
+    const bool result = JitCondition(self, test);
+    *self->output << (result || reverse ? "1" : "") << '\n';
+  }
+
+  static void JitPrintPieces(StringStackPlusPlus * self, const JitPrint * print) {
+    self->print_pieces.clear();
+    size_t total = 0;
+    for (const Value * piece : print->pieces) {
+      self->print_pieces.push_back(piece->view());
+      total += piece->size();
+    }
+    self->counters.operators[stats::PLUS] += print->pieces.size() - 1;
+    self->WritePrintPieces(total, print->reverse);
+  }
+
+  // The '}' ending a loop body, as ProcessRBRACE runs it: a checkpoint if
+  // one is due, then count it and check the budgets.  True to stop.
+  static bool JitLoopBack(StringStackPlusPlus * self, const JitBackedge * edge) {
+    if (self->checkpointer && self->checkpointer->Due()) self->CheckpointAt(*edge);
+    ++self->counters.statements;
+    if (self->WithinBudgets()) return false;
+    self->jit_stop = edge;
+    return true;
+  }
+
+  // Checkpoint as if the interpreter were about to run the '}' at 'edge'.
+  void CheckpointAt(const JitBackedge & edge) {
+    const size_t pos = lexer.GetPos(), depth = frames.size();
+    for (const Frame * frame : edge.frames) frames.push_back(*frame);
+    lexer.SetPos(edge.pos);
+    TakeCheckpoint();
+    frames.erase(frames.begin() + depth, frames.end());
+    lexer.SetPos(pos);
+  }
+
+  // Are the variables 'loop' was compiled against still the ones in scope?
+  bool IsCurrent(const CompiledLoop & loop) {
+    return std::all_of(loop.variables.begin(), loop.variables.end(),
+      [&](const auto & var) { return FindVariable(var.first) == var.second; });
+  }
+
+  bool JitEnabled() const {
+    return jit::supported && !trace::enabled && jit_threshold != JIT_NEVER;
+  }
+
+  // Compiled code for the loop opened by 'token', compiling it if it hasn't
+  // been yet (or if the variables it uses have moved); nullptr if the loop
+  // can't be compiled or would nest too deeply with 'open' blocks around it.
+  CompiledLoop * Compiled(LoopTier & tier, const Token & token, size_t cond_pos, size_t open) {
+    if (tier.rejected) return nullptr;
+    if (!tier.compiled || !IsCurrent(*tier.compiled)) {
+      tier.compiled = std::make_unique<CompiledLoop>();
+      if (LoopCompiler(*this, *tier.compiled).Compile(token, cond_pos)) {
+        ++counters.loops_compiled;
+      } else {
+        tier.compiled.reset();
+        tier.rejected = true;
+        ++counters.loops_rejected;
+        return nullptr;
+      }
+    }
+    if (open + tier.compiled->depth > max_depth) return nullptr;
+    return tier.compiled.get();
+  }
+
+  // Run 'loop' from its condition onwards, then end its statement.
+  void RunCompiled(const CompiledLoop & loop) {
+    jit_stop = nullptr;
+    const uint64_t status = loop.code();
+    cse.Clear();                       // Variables changed behind its back.
+    if (status != 0) CheckBudgets(jit_stop->token);
+    lexer.SetPos(loop.end_pos);
+    EndStatement();
+  }
+
+  // At a WHILE whose token has just been used: run the loop as compiled code
+  // if it is hot enough.  Returns false, having used nothing, if not.
+  bool EnterCompiled(const Token & token) {
+    const size_t cond_pos = lexer.GetPos() + 1;   // Past the '('
+    LoopTier & tier = jit_loops[cond_pos];
+    if (!tier.compiled && tier.iterations < jit_threshold) return false;
+    const CompiledLoop * loop = Compiled(tier, token, cond_pos, frames.size());
+    if (!loop) return false;
+    RunCompiled(*loop);
+    return true;
+  }
+
+  // At the backedge of the interpreted loop 'frame' (the innermost block),
+  // once its budgets have been checked: switch to compiled code, which picks
+  // up at the condition test.  Returns false if the loop can't be compiled.
+  bool TierUp(const Frame & frame) {
+    const CompiledLoop * loop = Compiled(jit_loops[frame.cond_pos], frame.token, frame.cond_pos,
+                                         frames.size() - 1);
+    if (!loop) return false;
+    frames.pop_back();
+    ++counters.tier_ups;
+    RunCompiled(*loop);
+    return true;
+  }
+
+  // The original text of a compressed value.
+  Value Unpack(const ColdValue & entry) {
+    const auto start = std::chrono::steady_clock::now();
+    Value out = Value::Filled(entry.size, [&](char * data) {
+      [[maybe_unused]] const bool ok = lz::Decompress(entry.packed.view(), data, entry.size);
+      assert(ok);
+    });
+    counters.restore_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    ++counters.values_restored;
+    return out;
+  }
+
+  // A use of variable 'var': restore it if it is compressed, and keep it from
+  // being compressed at the next sweep.
+  void Touch(Value & var) {
+    if (!cold.empty()) {
+      if (auto it = cold.find(&var); it != cold.end()) {
+        var = Unpack(it->second);
+        cold_saved -= it->second.size - it->second.packed.size();
+        cold.erase(it);
+      }
+    }
+    if (var.size() >= COLD_MIN_SIZE) used_since_sweep.insert(&var);
+  }
+
+  // 'var' is being overwritten or going away: forget its compressed copy.
+  void DropCold(const Value & var) {
+    if (auto it = cold.find(&var); it != cold.end()) {
+      cold_saved -= it->second.size - it->second.packed.size();
+      cold.erase(it);
+    }
+  }
+
+  // Compress 'var' if that saves enough to be worth it.  Values that didn't
+  // compress aren't tried again until they change.
+  void Freeze(Value & var) {
+    const std::pair<const char *, size_t> seen(var.data(), var.size());
+    if (auto it = incompressible.find(&var); it != incompressible.end() && it->second == seen) return;
+    const auto start = std::chrono::steady_clock::now();
+    Value packed(lz::Compress(var.view()));
+    counters.compress_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    if (packed.size() > var.size() / 8 * 7) {
+      incompressible.insert_or_assign(&var, seen);
+      return;
+    }
+    incompressible.erase(&var);
+    cold_saved += var.size() - packed.size();
+    counters.peak_cold_saved = std::max<uint64_t>(counters.peak_cold_saved, cold_saved);
+    ++counters.values_compressed;
+    cold.emplace(&var, ColdValue{ std::move(packed), var.size() });
+    var.Clear();
+  }
+
+  // Compress the large variables nothing has used since the last sweep.  A
+  // value shared with anything else (a copy in another variable or on the
+  // stack) is left alone: emptying this copy wouldn't free it.
+  void SweepCold() {
+    next_sweep = counters.statements + cold_after;
+    cse.Clear();                       // Its results hold copies.
+    for (auto & scope : symbol_stack) {
+      for (auto & [name, value] : scope) {
+        if (value.size() >= COLD_MIN_SIZE && !value.IsShared() && !used_since_sweep.contains(&value)) {
+          Freeze(value);
+        }
+      }
+    }
+    used_since_sweep.clear();
+  }
 
 public:
   StringStackPlusPlus(std::string filename) : filename(filename) { 
@@ -321,38 +1467,186 @@ public:
 
   // Run the entire program.
   void Run() {
+    Load();
+    Execute();
+  }
+
+  // Lex the program without running it.
+  void Load() {
     std::ifstream fs(filename);
-    lexer.Tokenize(fs);
+    counters.tokens = lexer.Tokenize(fs);
+  }
+
+  // Continue the loaded program from a checkpoint of an earlier run, taking
+  // over its values.  Returns false, with the reason in 'error', if the
+  // checkpoint was taken of a different program.
+  bool Resume(checkpoint::Snapshot && snap, std::string & error) {
+    const size_t num_tokens = lexer.NumTokens();
+    bool ok = snap.source_hash == checkpoint::Hash(lexer.Source()) &&
+              snap.num_tokens == num_tokens && snap.pos <= num_tokens && !snap.scopes.empty();
+    for (const checkpoint::Frame & frame : snap.frames) {
+      ok = ok && frame.type <= static_cast<uint64_t>(FrameType::WHILE) && frame.token_pos < num_tokens &&
+           frame.cond_pos <= num_tokens && frame.end_pos <= num_tokens;
+    }
+    if (!ok) {
+      error = "checkpoint does not match '" + filename + "' (was the program edited?)";
+      return false;
+    }
+    Execute(&snap);
+    return true;
+  }
+
+  // Replace the program with an edited version of its source (--watch).
+  // Only the changed lines are lexed again; returns how many that was.
+  size_t Reload(std::string source) {
+    const size_t lines = lexer.Relex(std::move(source));
+    counters.tokens = lexer.NumTokens();
+    return lines;
+  }
+
+  // Run the tokens already loaded, forgetting any previous run; or, given a
+  // checkpoint, carry on from where it was taken.
+  void Execute(checkpoint::Snapshot * from = nullptr) {
+    stack.clear();
+    symbol_stack.assign(1, {});
+    symbolDeclarationLines.clear();
+    lastIfCondition = justProcessedIf = inlineStatement = false;
+    frames.clear();
+    cse.Clear();
+    jit_loops.clear();
+    cold.clear();
+    used_since_sweep.clear();
+    incompressible.clear();
+    cold_saved = 0;
+    next_sweep = cold_after;
+    workers.clear();               // They hold a copy of the old program.
+    serial_until = 0;
+    counters = { .tokens = counters.tokens };
+    if (from) RestoreCheckpoint(*from);
+
+    if (limits.timeout > 0.0) {
+      watchdog.Start(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::duration<double>(limits.timeout)));
+    }
+    checkpointer.reset();
+    if (checkpoint_every > 0.0) {
+      source_hash = checkpoint::Hash(lexer.Source());
+      checkpointer = std::make_unique<checkpoint::Checkpointer>(checkpoint_path,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(checkpoint_every)));
+    }
+
+    while (lexer.Any()) {
+      if (checkpointer && checkpointer->Due()) TakeCheckpoint();
+      if (jobs > 1 && frames.empty() && !inlineStatement && RunParallelRange()) continue;
+      ProcessLine();
+    }
+
+    // A bare scope may run to the end of the file; other blocks must close.
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+      switch (it->type) {
+        case FrameType::SCOPE: break;
+        case FrameType::IF:    Error(it->token, "Unexpected End-of-File");
+        case FrameType::ELSE:  Error(it->token, "Expected '}' to close ELSE block");
+        case FrameType::WHILE: Error(it->token, "Expected '}' to close WHILE block");
+      }
+    }
+  }
+
+  void SetMaxDepth(size_t depth) { max_depth = depth; }
+
+  // Write a checkpoint to 'path' every 'seconds' of running time.
+  void SetCheckpoints(std::string path, double seconds) {
+    checkpoint_path = std::move(path);
+    checkpoint_every = seconds;
+  }
+
+  void SetCse(bool enabled) { use_cse = enabled; }
 
-    while (lexer.Any()) { ProcessLine(); }
+  // Compile loops after 'iterations' (or JIT_ALWAYS / JIT_NEVER).
+  void SetJitThreshold(size_t iterations) { jit_threshold = iterations; }
+
+  void SetJobs(size_t count) { jobs = std::max<size_t>(count, 1); pool.reset(); }
+
+  // Compress large variables left unused for 'statements' (0 never does).
+  void SetCompressCold(size_t statements) { cold_after = statements; }
+
+  const stats::Counters & GetCounters() const { return counters; }
+
+  // Statements before unused values are compressed, if they ever are.
+  std::optional<size_t> GetCompressCold() const {
+    if (!cold_after) return std::nullopt;
+    return cold_after;
+  }
+
+  // Iterations before loops are compiled, if they ever are.
+  std::optional<size_t> GetJitThreshold() const {
+    if (!JitEnabled()) return std::nullopt;
+    return jit_threshold;
+  }
+
+  void SetLimits(const Limits & in) {
+    limits = in;
+    step_limit = limits.max_steps ? limits.max_steps : SIZE_MAX;
+    memory_limit = limits.max_memory ? limits.max_memory : SIZE_MAX;
   }
 
-  // Interpret the next full line of code.
+  // Interpret the next statement.  Blocks don't recurse back into here:
+  // opening one pushes a Frame, and its closing '}' is processed as a
+  // statement of its own.
   void ProcessLine() {
     //std::cout<< "ProcessLine reached" << std::endl;
     assert(lexer.Any()); // Make sure there's something to process.
 
     // Figure out which type of token we are working with.
-    auto token = lexer.Use();
-    
+    const bool inlined = inlineStatement;
+    inlineStatement = false;
+    const Token & token = lexer.Use();
+    if (token != Lexer::ID_NEWLINE) {
+      ++counters.statements;
+      trace::Statement(token.line_id, token.lexeme);
+      if (cold_after && counters.statements >= next_sweep) SweepCold();
+    }
+
+    // Reused results are limited to straight-line code.
+    switch (token) {
+      case Lexer::ID_IF: case Lexer::ID_ELSE: case Lexer::ID_WHILE:
+      case Lexer::ID_LBRACE: case Lexer::ID_RBRACE:
+        cse.Clear();
+        break;
+      default:
+        break;
+    }
+
+    // The body of a single-line IF or ELSE must be a simple statement.
+    if (inlined) {
+      switch (token) {
+        case Lexer::ID_PRINT: case Lexer::ID_IF: case Lexer::ID_VAR:
+        case Lexer::ID_WHILE: case Lexer::ID_ID: case Lexer::ID_LIT_STRING:
+        case Lexer::ID_READ:
+          break;
+        default:
+          UnexpectedToken(token);
+      }
+    }
+
     switch (token) {
       case Lexer::ID_PRINT:  {
         ProcessPRINT(token);  
         break;
       }
+      // IF, ELSE, WHILE and '}' may leave the line unfinished, so they
+      // check the line ending themselves.
       case Lexer::ID_IF:   {
-        //std::cout<< "Is a if line" << std::endl;
         ProcessIF(token);   
-        break;
+        return;
       }
       case Lexer::ID_ELSE:   {
-        //std::cout<< "Is a if line" << std::endl;
         ProcessELSE(token);   
-        break;
+        return;
       }
       case Lexer::ID_WHILE: {
         ProcessWHILE(token); 
-        break;
+        return;
       }
       case Lexer::ID_VAR:  {
         ProcessVAR(token);  
@@ -362,14 +1656,18 @@ public:
         ProcessID(token);
         break;
       }
+      case Lexer::ID_READ: {
+        ProcessREAD(token);
+        break;
+      }
 
       case Lexer::ID_LBRACE: {
-        ProcessLBRACE();
+        ProcessLBRACE(token);
         break;
       }
       case Lexer::ID_RBRACE: {
         ProcessRBRACE(token);
-        break;
+        return;
       }
       case Lexer::ID_LIT_STRING:
         Error(token, "Left-hand-side of assignment must be a variable.");
@@ -381,80 +1679,128 @@ public:
         Error(token, "Unknown command '", token.lexeme, "'");
     }
 
-    // Make sure the line ends in a newline.
-    if (lexer.Any()) {
-      Token line_end = lexer.Use();
-      if (line_end != Lexer::ID_NEWLINE) {
-        //std::cout <<"Unexpected reached" << std::endl;
-        UnexpectedToken(line_end);
-      }
-      else if (line_end == Lexer::ID_IF) {
-        //std::cout << "UNEXPECTED IF REACHED" << std::endl;
-      }
-    }
+    EndStatement();
   }
 
-  void ProcessSingleStatement() {
+  // Make sure a statement ends in a newline (or the end of input, or the '}'
+  // closing the enclosing block, which is left for the next ProcessLine).
+  void EndStatement() {
     if (!lexer.Any()) return;
-    Token token = lexer.Use();
+    if (lexer.PeekId() == Lexer::ID_RBRACE && !frames.empty()) return;
+    if (lexer.PeekId() != Lexer::ID_NEWLINE) {
+      UnexpectedToken(lexer.Peek());
+    }
+    lexer.Skip();
+  }
 
-    switch (token.id) {
-      case Lexer::ID_PRINT:
-        ProcessPRINT(token);
-        break;
-      case Lexer::ID_IF:
-        ProcessIF(token);
-        break;
-      case Lexer::ID_VAR:
-        ProcessVAR(token);
-        break;
-      case Lexer::ID_WHILE:
-        ProcessWHILE(token);
-        break;
-      case Lexer::ID_ID:
-        ProcessID(token);
-        break;
-      case Lexer::ID_LIT_STRING:
-        Error(token, "Left-hand-side of assignment must be a variable.");
-        break;
-      default:
-        UnexpectedToken(token);
+  // Skip the rest of a block whose '{' has been used, including its '}'.
+  void SkipBlock(const Token & opener, const char * eof_message) {
+    size_t brace_depth = 1;
+    while (lexer.Any()) {
+      const int next = lexer.PeekId();
+      lexer.Skip();
+      if (next == Lexer::ID_LBRACE) brace_depth++;
+      else if (next == Lexer::ID_RBRACE && --brace_depth == 0) return;
+    }
+    Error(opener, eof_message);
+  }
+
+  // Skip a single statement without running it, stopping at the end of its
+  // line.  Any block the statement opens is skipped as a whole.
+  void SkipStatement() {
+    while (lexer.Any()) {
+      const int next = lexer.PeekId();
+      if (next == Lexer::ID_NEWLINE || next == Lexer::ID_RBRACE) return;
+      if (next == Lexer::ID_LBRACE) SkipBlock(lexer.Use(), "Unexpected End-of-File");
+      else lexer.Skip();
+    }
+  }
+
+  void PushFrame(Frame frame) {
+    if (frames.size() >= max_depth) {
+      RuntimeError(frame.token, "Blocks nested more than ", max_depth, " deep (see --max-depth)");
+    }
+    frames.push_back(std::move(frame));
+  }
+
+
+  // If the rest of the statement is "a + b + ..." over variables and
+  // literals, the number of tokens it takes up; otherwise 0.
+  size_t PiecesLength() const {
+    size_t end = 0;
+    for (;; end += 2) {
+      const int id = lexer.PeekId(end);
+      if (id != Lexer::ID_ID && id != Lexer::ID_LIT_STRING) return 0;
+      if (lexer.PeekId(end + 1) != Lexer::ID_PLUS) break;
     }
+    switch (lexer.PeekId(end + 1)) {
+      case Lexer::ID_NEWLINE: case Lexer::ID_RBRACE: case Lexer::ID__EOF_: return end + 1;
+      default: return 0;
+    }
+  }
+
+  // If the rest of the statement is "a + b + ..." over variables and
+  // literals, PRINT it piece by piece and return true; otherwise use nothing.
+  bool PrintPieces(bool reverse) {
+    const size_t length = PiecesLength();
+    if (length == 0) return false;
+
+    print_pieces.clear();
+    size_t total = 0;
+    for (size_t i = 0; i < length; i += 2) {
+      const Token operand = lexer.Use();
+      print_pieces.push_back(operand == Lexer::ID_ID ? IDToString(operand).view()
+                                                      : operand.lexeme.substr(1, operand.lexeme.size() - 2));
+      total += print_pieces.back().size();
+      if (i + 1 < length) lexer.Skip();   // '+'
+    }
+    counters.operators[stats::PLUS] += length / 2;
+    WritePrintPieces(total, reverse);
+    return true;
   }
 
+  // Write print_pieces, 'total' bytes in all, as one line of PRINT output.
+  void WritePrintPieces(size_t total, bool reverse) {
+    if (total == 0 && reverse) print_pieces.push_back("1");
+    print_pieces.push_back("\n");
+
+    if (output == &std::cout && total >= WRITEV_MIN_BYTES) {
+      std::cout.flush();                  // Earlier output goes first.
+      if (!WriteGathered(STDOUT_FILENO, print_pieces)) std::cout.setstate(std::ios::badbit);
+    } else {
+      for (std::string_view piece : print_pieces) output->write(piece.data(), piece.size());
+    }
+  }
 
-  
   void ProcessPRINT(const Token &token) {
     bool reverse = false;
-    std::string out;
+    Value out;
 
     if (!HasArg()) {
       out = StackPop(token);
     } else {
-      Token next = lexer.Peek();
-
-      if (next.id == Lexer::ID_NOT) {
+      if (lexer.PeekId() == Lexer::ID_NOT) {
         reverse = true;
-        lexer.Use();
-        next = lexer.Peek();
+        lexer.Skip();
       }
 
+      if (PrintPieces(reverse)) return;
       if (!lexer.Any()) Error(token, "Expected expression in PRINT");
-      Token first = lexer.Use();
+      const Token & first = lexer.Use();
 
       if (first == Lexer::ID_LPAREN) {
-        Token lookahead = lexer.Peek();
-        Token lookahead2 = lexer.Peek(1);
+        const int lookahead = lexer.PeekId();
+        const int lookahead2 = lexer.PeekId(1);
 
         // Is it a boolean expression?
         if ((lookahead == Lexer::ID_ID || lookahead == Lexer::ID_LIT_STRING) && (lookahead2 == Lexer::ID_EQ || lookahead2 == Lexer::ID_NEQ || lookahead2 == Lexer::ID_LE || lookahead2 == Lexer::ID_GE || lookahead2 == Lexer::ID_LT || lookahead2 == Lexer::ID_GT || lookahead2 == Lexer::ID_QUESTION)) {
           bool result = ParseExpression();
 
           // Check for RPAREN
-          if (!lexer.Any() || lexer.Peek() != Lexer::ID_RPAREN) {
+          if (!lexer.Any() || lexer.PeekId() != Lexer::ID_RPAREN) {
             Error(token, "Expected ')' after expression in PRINT");
           }
-          lexer.Use();
+          lexer.Skip();
 
           out = result ? "1" : "";
         } else {
@@ -466,8 +1812,8 @@ public:
       }
     }
 
-    if (out == "" && reverse) out = "1";
-    std::cout << out << std::endl;
+    if (out.empty() && reverse) out = "1";
+    *output << out << '\n';
   }
 
 
@@ -478,72 +1824,22 @@ public:
     if (!lexer.Any()) {
       Error(token, "Unexpected Eof");
     }
-    Token paren = lexer.Peek();
-    if (paren != Lexer::ID_LPAREN) {
-      Error(token, "Expected token of type '(', but found type ", TokenIDToString(paren));
+    if (lexer.PeekId() != Lexer::ID_LPAREN) {
+      Error(token, "Expected token of type '(', but found type ", TokenIDToString(lexer.Peek()));
     }
-    lexer.Use();
+    lexer.Skip();
 
     bool condition = ParseExpression();
     lastIfCondition = condition;
     justProcessedIf = true;
+    trace::Branch(token.line_id, "IF", condition);
 
-    if (!lexer.Any() || lexer.Peek() != Lexer::ID_RPAREN) {
+    if (!lexer.Any() || lexer.PeekId() != Lexer::ID_RPAREN) {
       Error(token, "Cannot chain non-associative operators.");
     }
-    lexer.Use();
-
-    if (lexer.Any() && lexer.Peek() == Lexer::ID_LBRACE) {
-      //ProcessLBRACE();
-      lexer.Use();
-
-      if (condition) {
-        // Execute lines until '}'
-        while (lexer.Any() && lexer.Peek() != Lexer::ID_RBRACE) {
-          ProcessLine();
-        }
-      } else {
-        // Skip lines until matching '}'
-        int brace_depth = 1;
-        while (lexer.Any() && brace_depth > 0) {
-          Token next = lexer.Peek();
-          if (next == Lexer::ID_LBRACE) {
-            //ProcessLBRACE();
-            brace_depth++;
-          }
-          else if (next == Lexer::ID_RBRACE) {
-            //ProcessRBRACE(next);
-            brace_depth--;
-          }
-          if (brace_depth != 0) {
-              next = lexer.Use();
-          }
-        }
-      }
-
-      // Make sure we found the closing '}'
-      if (!lexer.Any() || lexer.Peek() != Lexer::ID_RBRACE) {
-        Error(token, "Unexpected End-of-File");
-      }
-      //ProcessRBRACE(lexer.Peek());
-      lexer.Use(); // consume '}'
-    } else {
-      // Single line IF
-      //std::cout<< "Single line if" << std::endl;
-      if (condition) {
-        //std::cout<< "Single line if true" << std::endl;
-        ProcessSingleStatement();
-      } else {
-        // Skip the next line
-        //std::cout<< "Single line if false" << std::endl;
-        while (lexer.Any()) {
-          Token tok = lexer.Peek();
-          if (tok == Lexer::ID_NEWLINE) return;
-          tok = lexer.Use();
-        }
-      }
-    }
+    lexer.Skip();
 
+    RunBranch(token, FrameType::IF, condition);
   }
 
   void ProcessELSE(const Token & token) {
@@ -551,755 +1847,71 @@ public:
       Error(token, "ELSE without matching IF");
     }
     justProcessedIf = false;  // Reset after ELSE
-    
-    if (lexer.Any() && lexer.Peek() == Lexer::ID_LBRACE) {
-      //ProcessLBRACE();
-      lexer.Use();
-      if (!lastIfCondition) {
-        // Run else statement
-        while (lexer.Any() && lexer.Peek() != Lexer::ID_RBRACE) {
-          ProcessLine();
-        }
-      } else {
-        // Skip else statement
-        int brace_depth = 1;
-        while (lexer.Any() && brace_depth > 0) {
-          Token next = lexer.Peek();
-          if (next == Lexer::ID_LBRACE) {
-            //ProcessLBRACE();
-            brace_depth++;
-          }
-          else if (next == Lexer::ID_RBRACE) {
-            //ProcessRBRACE(next);
-            brace_depth--;
-          }
-          if (brace_depth != 0) {
-              next = lexer.Use();
-          }
-        }
-      }
-
-      // Consume '}'
-      if (!lexer.Any() || lexer.Peek() != Lexer::ID_RBRACE) {
-        Error(token, "Expected '}' to close ELSE block");
-      }
-      //ProcessRBRACE(lexer.Peek());
-      lexer.Use();
-    } else {
-      // Single-line else
-      if (!lastIfCondition) {
-        ProcessSingleStatement();
-      } else {
-        // Skip single statement
-        while (lexer.Any()) {
-          Token tok = lexer.Peek();
-          if (tok == Lexer::ID_NEWLINE) return;
-          tok = lexer.Use();
-        }
-      }
-    }
-  }
-
-  bool ParseWHILEExpression(const std::vector<Token>& expression) {
-    bool valid = false;
-    bool notPresent = false;
-    bool rightSide = false;
-    std::string leftValue;
-    std::string rightValue;
-    Token op;
-
-    size_t index = 0;
-    auto next = [&]() -> Token {
-      if (index >= expression.size()) {
-          Error(expression.back(), "Unexpected end of expression");
-      }
-      return expression[index++];
-    };
-
-    Token current = next();
-    if (current == Lexer::ID_NOT) {
-      notPresent = true;
-      if (index >= expression.size()) {
-          Error(current, "Expected expression after NOT");
-      }
-      current = next();
-    }
-
-    if (current == Lexer::ID_ID || current == Lexer::ID_LIT_STRING) {
-      if (current == Lexer::ID_ID) {
-        std::string name = current.lexeme;
-        bool leftFound = false;
-        for (auto scope_it = symbol_stack.rbegin(); scope_it != symbol_stack.rend(); ++scope_it) {
-          auto it = scope_it->find(name);
-          if (it != scope_it->end()) {
-            leftValue = scope_it->find(name)->second;
-            leftFound = true;
-            break;
-          }
-        }
-        if (!leftFound) Error(current, "Undefined variable '", name, "'");
-      }else {
-        leftValue = TokenToString(current);
-      }
-
-      if (index < expression.size()) {
-        rightSide = true;
-        Token possible_op = next();
-
-        switch (possible_op.id) {
-          case Lexer::ID_EQ:
-          case Lexer::ID_NEQ:
-          case Lexer::ID_LE:
-          case Lexer::ID_GE:
-          case Lexer::ID_LT:
-          case Lexer::ID_GT:
-          case Lexer::ID_QUESTION:
-            op = possible_op;
-              break;
-            default:
-              Error(possible_op, "Expected comparison operator, got '", possible_op.lexeme, "'");
-        }
-        if (index >= expression.size()) {
-            Error(op, "Expected right-hand expression after operator");
-        }
-
-        Token right = next();
-        if (right == Lexer::ID_ID || right == Lexer::ID_LIT_STRING) {
-          if (right == Lexer::ID_ID) {
-          std::string name = right.lexeme;
-          bool rightFound = false;
-          for (auto scope_it = symbol_stack.rbegin(); scope_it != symbol_stack.rend(); ++scope_it) {
-            auto it = scope_it->find(name);
-            if (it != scope_it->end()) {
-            rightValue = scope_it->find(name)->second;
-            rightFound = true;
-            break;
-            }
-          }
-          if (!rightFound) Error(right, "Undefined variable '", name, "'");
-        }else {
-          rightValue = TokenToString(right);
-        }
-        } else {
-          Error(right, "Expected identifier or string literal after operator");
-        }
-      }
-    } else {
-      Error(current, "Expected identifier or string literal in expression");
-    }
-
-    if (!rightSide) {
-      if (leftValue == "") {
-        valid = false;
-      }
-      else {
-        valid = true;
-      }
-    } else {
-      if (op == Lexer::ID_EQ)         valid = (leftValue == rightValue);
-      else if (op == Lexer::ID_NEQ)   valid = (leftValue != rightValue);
-      else if (op == Lexer::ID_LT)    valid = (leftValue < rightValue);
-      else if (op == Lexer::ID_LE)    valid = (leftValue <= rightValue);
-      else if (op == Lexer::ID_GT)    valid = (leftValue > rightValue);
-      else if (op == Lexer::ID_GE)    valid = (leftValue >= rightValue);
-      else if (op == Lexer::ID_QUESTION) valid = (leftValue.find(rightValue) != std::string::npos);
-      else Error(op, "Unknown operator in expression");
-    }
-
-    if (notPresent) {
-      valid = !valid;
-    }
-
-    return valid;
-  }
-
-  int ProcessPRINTFromVector(const std::vector<Token>& tokens, size_t k) {
-    bool reverse = false;
-    std::string out;
-
-    const Token& token = tokens[k];
-    k++;
-
-    if (k >= tokens.size()) {
-      out = StackPop(token);
-    } else {
-      Token next = tokens[k];
-
-      if (next.id == Lexer::ID_NOT) {
-        reverse = true;
-        k++;
-        if (k >= tokens.size()) Error(token, "Expected expression after NOT in PRINT");
-      }
-      if (tokens[k].id == Lexer::ID_LPAREN) {
-        int parenDepth = 1;
-        int start = k + 1;
-        size_t end = start;
-
-        while (end < tokens.size() && parenDepth > 0) {
-            if (tokens[end].id == Lexer::ID_LPAREN) parenDepth++;
-            else if (tokens[end].id == Lexer::ID_RPAREN) parenDepth--;
-            end++;
-        }
-        if (parenDepth != 0) {
-          Error(tokens[k], "Unmatched parentheses in PRINT expression");
-        }
-
-        std::vector<Token> subExpr(tokens.begin() + start, tokens.begin() + end - 1);
-        if (subExpr.size() >= 3 &&
-          (subExpr[1].id == Lexer::ID_EQ || subExpr[1].id == Lexer::ID_NEQ ||
-            subExpr[1].id == Lexer::ID_LE || subExpr[1].id == Lexer::ID_GE ||
-            subExpr[1].id == Lexer::ID_LT || subExpr[1].id == Lexer::ID_GT ||
-            subExpr[1].id == Lexer::ID_QUESTION)) {
-          bool result = ParseWHILEExpression(subExpr);
-          out = result ? "1" : "";
-        } else {
-          size_t dummy = 0;
-          out = CompleteCalculationFromVector(subExpr, 0, &dummy);
-        }
-        k = end;
-      }
-      else {
-        out = CompleteCalculationFromVector(tokens, k, &k);
-      }
-    }
-
-    if (reverse && out.empty()) {
-      out = "1";
-    }
-
-    std::cout << out << std::endl;
-    return k;
-  }
-
-
-
-  int ProcessIFFromVector(const std::vector<Token>& tokens, size_t k) {
-    const Token& token = tokens[k];
-    k++;
-
-    if (k >= tokens.size() || tokens[k].id != Lexer::ID_LPAREN) {
-      Error(token, "Cannot chain non-associative operators.");
-    }
-    k++;
-
-    int parenDepth = 1;
-    int exprStart = k;
-    size_t exprEnd = k;
-
-    while (exprEnd < tokens.size() && parenDepth > 0) {
-      if (tokens[exprEnd].id == Lexer::ID_LPAREN) parenDepth++;
-      else if (tokens[exprEnd].id == Lexer::ID_RPAREN) parenDepth--;
-      exprEnd++;
-    }
-
-    if (parenDepth != 0) {
-      Error(token, "Unclosed '(' in IF condition");
-    }
-
-    // Check condition
-    std::vector<Token> conditionExpr(tokens.begin() + exprStart, tokens.begin() + exprEnd - 1);
-    bool condition = ParseWHILEExpression(conditionExpr);
-    lastIfCondition = condition;
-    justProcessedIf = true;
-
-    k = exprEnd;
-
-    if (k < tokens.size() && tokens[k].id == Lexer::ID_LBRACE) {
-      k++;
-
-      if (condition) {
-        // IF block
-        int braceDepth = 1;
-        int stmtStart = k;
-        while (k < tokens.size() && braceDepth > 0) {
-          if (tokens[k].id == Lexer::ID_LBRACE) braceDepth++;
-          else if (tokens[k].id == Lexer::ID_RBRACE) braceDepth--;
-          if (braceDepth > 0) k++;
-        }
-
-        if (braceDepth != 0) {
-          Error(token, "Unexpected End-of-File");
-        }
-
-        size_t execK = stmtStart;
-        while (execK < k) {
-          execK = ProcessLineFromVector(tokens, execK);
-        }
-
-          k++;
-      } else {
-        // Skip IF block
-        int braceDepth = 1;
-        while (k < tokens.size() && braceDepth > 0) {
-          if (tokens[k].id == Lexer::ID_LBRACE) braceDepth++;
-          else if (tokens[k].id == Lexer::ID_RBRACE) braceDepth--;
-          k++;
-        }
-
-        if (braceDepth != 0) {
-          Error(token, "Expected '}' to close skipped IF block");
-        }
-      }
-    } else {
-      // Single-line IF
-      if (condition) {
-        k = ProcessLineFromVector(tokens, k);
-      } else {
-        // Skip Single-line IF
-        while (k < tokens.size() && tokens[k].id != Lexer::ID_NEWLINE &&
-          tokens[k].id != Lexer::ID_RBRACE) {
-          k++;
-        }
-      }
-    }
-    return k;
-  }
-
-  int ProcessELSEFromVector(const std::vector<Token>& tokens, size_t k) {
-    const Token& token = tokens[k];
-
-    if (!justProcessedIf) {
-      Error(token, "ELSE without matching IF");
-    }
-    justProcessedIf = false;
-
-    k++;
-
-    if (k < tokens.size() && tokens[k].id == Lexer::ID_LBRACE) {
-      k++;
-
-      if (!lastIfCondition) {
-        // ELSE block
-        int braceDepth = 1;
-        int stmtStart = k;
-        while (k < tokens.size() && braceDepth > 0) {
-          if (tokens[k].id == Lexer::ID_LBRACE) braceDepth++;
-          else if (tokens[k].id == Lexer::ID_RBRACE) braceDepth--;
-
-          if (braceDepth > 0) k++;
-        }
-
-        if (braceDepth != 0) {
-          Error(token, "Expected '}' to close ELSE block");
-        }
-
-        size_t execK = stmtStart;
-        while (execK < k) {
-          execK = ProcessLineFromVector(tokens, execK);
-        }
-
-        k++;
-      } else {
-        // Skip ELSE block
-        int braceDepth = 1;
-        while (k < tokens.size() && braceDepth > 0) {
-          if (tokens[k].id == Lexer::ID_LBRACE) braceDepth++;
-          else if (tokens[k].id == Lexer::ID_RBRACE) braceDepth--;
-          k++;
-        }
-
-        if (braceDepth != 0) {
-          Error(token, "Expected '}' to close ELSE block");
-        }
-      }
-    } else {
-      // Single-line ELSE
-      if (!lastIfCondition) {
-        k = ProcessLineFromVector(tokens, k);
-      } else {
-        // Skip single-line else
-        while (k < tokens.size() &&
-          tokens[k].id != Lexer::ID_NEWLINE &&
-          tokens[k].id != Lexer::ID_RBRACE) {
-          k++;
-        }
-      }
-    }
-    return k;
-  }
-
-  int ProcessVARFromVector(const std::vector<Token>& tokens, size_t k) {
-    const Token& token = tokens[k];
-    k++;
-
-    if (k >= tokens.size() || tokens[k].id != Lexer::ID_ID) {
-      Error(token, "Expected identifier after VAR");
-    }
-
-    Token var_token = tokens[k++];
-    std::string var_name = var_token.lexeme;
-
-    // ensure new variable
-    auto& current_scope = symbol_stack.back();
-    if (current_scope.find(var_name) != current_scope.end()) {
-      int originalLine = symbolDeclarationLines.count(var_name) ? symbolDeclarationLines[var_name] : -1;
-      std::string lineStr = (originalLine != -1) ? std::to_string(originalLine) : "?";
-      Error(var_token, "Redeclaration of variable '", var_name, "' (originally defined on line ", lineStr, ")");
-    }
-
-    if (k >= tokens.size() || tokens[k].id != Lexer::ID_ASSIGN) {
-      Error(var_token, "Expected '=' after variable name");
-    }
-    k++;
-
-    if (k >= tokens.size()) {
-      Error(var_token, "Expected expression after '='");
-    }
-
-    std::string result;
-    Token current = tokens[k];
-    if (current.id == Lexer::ID_ID || current.id == Lexer::ID_LIT_STRING) {
-      result = TokenToString(current);
-      k++;
-    } else {
-      Error(current, "Expected string literal or variable in expression");
-    }
-
-    while (k < tokens.size() && tokens[k].id == Lexer::ID_PLUS) {
-      k++;
-
-      if (k >= tokens.size()) {
-        Error(current, "Expected value after '+'");
-      }
-
-      Token next = tokens[k++];
-      if (next.id == Lexer::ID_ID || next.id == Lexer::ID_LIT_STRING) {
-        result += TokenToString(next);
-      } else {
-        Error(next, "Expected string literal or variable after '+'");
-      }
-    }
-
-    // Chains
-    if (k < tokens.size() && tokens[k].id == Lexer::ID_ASSIGN) {
-      k++;
-
-      if (k >= tokens.size()) {
-        Error(current, "Expected value after '='");
-      }
-
-      Token next2 = tokens[k++];
-      if (next2.id == Lexer::ID_ID || next2.id == Lexer::ID_LIT_STRING) {
-        result = TokenToString(next2);
-
-        if (current.id == Lexer::ID_ID) {
-          current_scope[current.lexeme] = result;
-          symbolDeclarationLines[current.lexeme] = current.line_id;
-        }
-      } else {
-        Error(next2, "Expected string literal or variable after '='");
-      }
-    }
-
-    current_scope[var_name] = result;
-    symbolDeclarationLines[var_name] = var_token.line_id;
-
-    return k;
-  }
-
-  int ProcessIDFromVector(const std::vector<Token>& tokens, size_t k) {
-    if (k >= tokens.size()) {
-      Error(Token{}, "Unexpected end of tokens in ProcessIDFromVector");
-    }
-
-    const Token& token = tokens[k++];
-    std::string name = token.lexeme;
-
-    // Ensure variable already exists
-    bool found = false;
-    for (auto scope_it = symbol_stack.rbegin(); scope_it != symbol_stack.rend(); ++scope_it) {
-      if (scope_it->find(name) != scope_it->end()) {
-        found = true;
-        break;
-      }
-    }
-    if (!found) {
-      Error(token, "Assignment to undeclared variable '", name, "'");
-    }
-
-    if (k >= tokens.size() || tokens[k].id != Lexer::ID_ASSIGN) {
-      Error(token, "Expected '=' after variable name");
-    }
-    k++;
-
-    if (k >= tokens.size()) {
-      Error(token, "Expected expression after '='");
-    }
-
-    bool reverse = false;
-    Token first = tokens[k];
-
-    if (first.id == Lexer::ID_NOT) {
-      reverse = true;
-      k++;
-      if (k >= tokens.size()) {
-        Error(token, "Expected expression after '!'");
-      }
-      first = tokens[k];
-    }
-
-    std::string value;
-
-    if (first.id == Lexer::ID_ID || first.id == Lexer::ID_LIT_STRING || first.id == Lexer::ID_LPAREN) {
-      std::vector<Token> exprTokens;
-      int depth = 0;
-
-      while (k < tokens.size()) {
-        Token t = tokens[k];
-        if (t.id == Lexer::ID_LPAREN) depth++;
-        else if (t.id == Lexer::ID_RPAREN) {
-          if (depth == 0) break;
-          depth--;
-        } else if (depth == 0 && t.id == Lexer::ID_NEWLINE) break;
-        exprTokens.push_back(t);
-        k++;
-      }
-      int dummyIndex = 0;
-      value = CompleteCalculationFromVector(exprTokens, dummyIndex);
-    } else {
-        Error(first, "Expected identifier, string literal, or expression after '='");
-    }
-
-    if (reverse) {
-      value = (value.empty()) ? "1" : "";
-    }
-
-    // Reassign variable
-    for (auto scope_it = symbol_stack.rbegin(); scope_it != symbol_stack.rend(); ++scope_it) {
-      if (scope_it->find(name) != scope_it->end()) {
-        (*scope_it)[name] = value;
-        break;
-      }
-    }
-    return k;
-  }
-
-
-  int ProcessLineFromVector(const std::vector<Token>& tokens, size_t k) {
-    if (k >= tokens.size()) {
-      Error(Token{}, "Unexpected end of tokens in ProcessLineFromVector");
-    }
-    const Token& token = tokens[k++];
-    switch (token.id) {
-      case Lexer::ID_PRINT:
-        k = ProcessPRINTFromVector(tokens, k);
-        break;
-      case Lexer::ID_IF:
-        k = ProcessIFFromVector(tokens, k);
-        break;
-      case Lexer::ID_ELSE:
-        k = ProcessELSEFromVector(tokens, k);
-        break;
-      case Lexer::ID_WHILE:
-        break;
-      case Lexer::ID_VAR:
-        k = ProcessVARFromVector(tokens, k);
-        break;
-      case Lexer::ID_ID:
-        k = ProcessIDFromVector(tokens, k);
-        break;
-      case Lexer::ID_LBRACE:
-        break;
-      case Lexer::ID_RBRACE:
-        break;
-      case Lexer::ID_NEWLINE:
-        return k;
-        break;
-      default:
-        Error(token, "Unknown command '", token.lexeme, "'");
-    }
-    if (k < tokens.size()) {
-      if (tokens[k].id == Lexer::ID_NEWLINE) {
-        k++;
-      } else {
-        UnexpectedToken(tokens[k]);
-      }
-    }
-    return k;
-  }
-
-  std::string CompleteCalculationFromVector(const std::vector<Token>& tokens, size_t k, size_t* outIndex = nullptr) {
-    if (k >= tokens.size()) {
-      Error(Token{}, "Expected expression but reached end of tokens");
-    }
-
-    std::vector<Token> expressionTokens;
-    int depth = 0;
-
-    while (k < tokens.size()) {
-      const Token& t = tokens[k];
-
-      if (t.id == Lexer::ID_LPAREN) {
-        depth++;
-      } else if (t.id == Lexer::ID_RPAREN) {
-        if (depth == 0) break;
-        depth--;
-      } else if (depth == 0 && t.id == Lexer::ID_NEWLINE) {
-        break;
-      }
-      expressionTokens.push_back(t);
-      k++;
-    }
-
-    if (expressionTokens.empty()) {
-      Error(tokens[k], "Expected expression for calculation");
-    }
+    trace::Branch(token.line_id, "ELSE", !lastIfCondition);
 
-    size_t exprIndex = 0;
-    std::string result = ParseExprFromVector(expressionTokens, exprIndex);
-
-    if (outIndex) {
-      *outIndex = k;
-    }
-
-    return result;
+    RunBranch(token, FrameType::ELSE, !lastIfCondition);
   }
 
-
-  std::string ParseExprFromVector(const std::vector<Token>& tokens, size_t& index) {
-    if (index >= tokens.size()) {
-      Error(Token{}, "Expected expression but reached end of tokens");
-    }
-
-    std::string left = ParseTermFromVector(tokens, index);
-
-    while (index < tokens.size() && 
-      (tokens[index].id == Lexer::ID_PLUS || tokens[index].id == Lexer::ID_MINUS)) {
-        
-      Token op = tokens[index];
-      index++;
-
-      if (index >= tokens.size()) {
-        Error(op, "Expected value after operator");
-      }
-
-      std::string right = ParseTermFromVector(tokens, index);
-      left = ApplyOperator(op, left, right);
-    }
-    return left;
+  // Shared by IF and ELSE: start or skip the block or single statement that
+  // follows.  A block that runs is entered by pushing a frame; its body is
+  // then processed by the main loop like any other lines.
+  void RunBranch(const Token & token, FrameType type, bool run) {
+    if (lexer.Any() && lexer.PeekId() == Lexer::ID_LBRACE) {
+      lexer.Skip();
+      if (run) {
+        PushFrame({ .type = type, .token = token });
+        return;
+      }
+      SkipBlock(token, type == FrameType::IF ? "Unexpected End-of-File"
+                                             : "Expected '}' to close ELSE block");
+    }
+    else if (run) {
+      inlineStatement = true;   // The rest of the line is the body.
+      return;
+    }
+    else SkipStatement();
+    EndStatement();
   }
 
-  std::string ParseTermFromVector(const std::vector<Token> &tokens, size_t &index) {
-    if (index >= tokens.size()) {
-      Error(Token{}, "Expected term but reached end of tokens");
-    }
-
-    std::string left = ParsePrimaryFromVector(tokens, index);
-
-    while (index < tokens.size() && (tokens[index].id == Lexer::ID_SLASH || tokens[index].id == Lexer::ID_PERCENT)) {
-      Token op = tokens[index];
-      index++;  // consume operator
-
-      if (index >= tokens.size()) {
-        Error(op, "Expected value after operator");
-      }
-
-      std::string right = ParsePrimaryFromVector(tokens, index);
-      left = ApplyOperator(op, left, right);
-    }
-    return left;
-  }
-
-  std::string ParsePrimaryFromVector(const std::vector<Token> &tokens, size_t &index) {
-    if (index >= tokens.size()) {
-      Error(Token{}, "Expected expression but reached end of tokens");
-    }
-
-    Token token = tokens[index];
-    index++;
+  void ProcessWHILE(const Token & token) {
+    if (JitEnabled() && EnterCompiled(token)) return;
 
-    if (token == Lexer::ID_ID || token == Lexer::ID_LIT_STRING) {
-      return TokenToString(token);
+    // Check for '('
+    if (!lexer.Any() || lexer.PeekId() != Lexer::ID_LPAREN) {
+      Error(token, "Expected '(' after WHILE");
     }
+    lexer.Skip();
 
-    if (token == Lexer::ID_LPAREN) {
-      if (index >= tokens.size()) {
-        Error(token, "Expected expression after '('");
-      }
-
-      std::string value = ParseExprFromVector(tokens, index);
-
-      if (index >= tokens.size() || tokens[index] != Lexer::ID_RPAREN) {
-        Error(token, "Missing parenthesis");
-      }
-      index++;
-      return value;
+    const size_t cond_pos = lexer.GetPos();
+    if (!TestWHILECondition(token)) {
+      SkipBlock(token, "Expected '}' to close WHILE block");
+      trace::LoopEnd(token.line_id, 0);
+      EndStatement();
+      return;
     }
-
-    Error(token, "Unexpected token '", token.lexeme, "'");
-    return "";
+    PushFrame({ .type = FrameType::WHILE, .token = token, .cond_pos = cond_pos, .iterations = 1 });
+    trace::Loop(token.line_id, 1);
   }
 
-
-  void ProcessWHILE(const Token & token) {
-    // Check for '('
-    if (!lexer.Any() || lexer.Peek() != Lexer::ID_LPAREN) {
-      Error(token, "Expected '(' after WHILE");
-    }
-    lexer.Use();
-
-    // create condition vector
-    std::vector<Token> cond;
-    int depth = 1;
-    while (lexer.Any() && depth > 0) {
-      Token t = lexer.Use();
-      if (t.id == Lexer::ID_LPAREN) depth++;
-      else if (t.id == Lexer::ID_RPAREN) depth--;
-      if (depth > 0) {
-        cond.push_back(t);
-      }
+  // Evaluate a WHILE condition, starting just past its '(', and use the '{'
+  // that opens the body.
+  bool TestWHILECondition(const Token & token) {
+    bool condition = ParseExpression();
+    if (!lexer.Any() || lexer.PeekId() != Lexer::ID_RPAREN) {
+      Error(token, "Expected ')' after WHILE condition");
     }
+    lexer.Skip();
 
     // Check for '{'
     if (!lexer.Any()) {
       Error(token, "Unexpected eof");
     }
-    Token brace = lexer.Peek();
-    if (brace != Lexer::ID_LBRACE) {
+    if (lexer.PeekId() != Lexer::ID_LBRACE) {
+      const Token brace = lexer.Peek();
       Error(brace, "Unexpected token '", TokenIDToString(brace),"'");
     }
-    lexer.Use();
-
-    // create body vector
-    std::vector<Token> body;
-    int brace_depth = 1;
-    while (lexer.Any() && brace_depth > 0) {
-      Token t = lexer.Use();
-      if (t.id == Lexer::ID_LBRACE) brace_depth++;
-      else if (t.id == Lexer::ID_RBRACE) brace_depth--;
-      if (brace_depth > 0) {
-        body.push_back(t);
-      }
-    }
-
-    while (ParseWHILEExpression(cond)) {
-      size_t k = 0;
-      while (k < body.size()) {
-        Token current = body[k];
-        switch (current.id) {
-          case Lexer::ID_PRINT:
-            k = ProcessPRINTFromVector(body, k);
-            break;
-          case Lexer::ID_VAR:
-            k = ProcessVARFromVector(body, k);
-            break;
-          case Lexer::ID_ID:
-            k = ProcessIDFromVector(body, k);
-            break;
-          case Lexer::ID_IF:
-            k = ProcessIFFromVector(body, k);
-            break;
-          case Lexer::ID_ELSE:
-            k = ProcessELSEFromVector(body, k);
-            break;
-          case Lexer::ID_NEWLINE:
-            k++;
-            break;
-          default:
-            Error(current, "Unknown command '", current.lexeme, "'");
-        }
-      }
-    }
+    lexer.Skip();
+    return condition;
   }
 
 
@@ -1315,14 +1927,15 @@ public:
     Token next = var_token;
 
     // store variable name
-    std::string var_name = var_token.lexeme;
+    const std::string_view var_name = var_token.lexeme;
 
     // check redeclaration
     auto &current_scope = symbol_stack.back();
     if (current_scope.find(var_name) != current_scope.end()) {
-      int originalLine = symbolDeclarationLines.count(var_name) ? symbolDeclarationLines[var_name] : -1;
+      auto line_it = symbolDeclarationLines.find(var_name);
+      int originalLine = (line_it != symbolDeclarationLines.end()) ? line_it->second : -1;
       std::string lineStr = (originalLine != -1) ? std::to_string(originalLine) : "?";
-      Error(var_token, "Redeclaration of variable '", var_name, "' (originally defined on line ", lineStr, ")");
+      RuntimeError(var_token, "Redeclaration of variable '", var_name, "' (originally defined on line ", lineStr, ")");
     }
 
     // consume '=' operator
@@ -1333,7 +1946,7 @@ public:
     next = lexer.Use();
 
     // store variable value (is Lexer::ID_LIT_STRING)
-    std::string result;
+    Value result;
     if (!lexer.Any()) Error(var_token, "Expected expression after '='");
     Token current = lexer.Use();
     next = current;
@@ -1345,14 +1958,14 @@ public:
 
     // check if next token is '+' operator
     // if is is, add token after '+' to the variable value
-    while (lexer.Any() && lexer.Peek() == Lexer::ID_PLUS) {
+    while (lexer.Any() && lexer.PeekId() == Lexer::ID_PLUS) {
       next = lexer.Use(); // consume '+'
 
       if (!lexer.Any()) Error(current, "Expected value after '+'");
       Token next1 = lexer.Use();
       next = next1;
       if (next1 == Lexer::ID_ID || next1 == Lexer::ID_LIT_STRING) {
-        result += TokenToString(next1);
+        result.Append(TokenToString(next1));
       } else {
         Error(next1, "Expected string literal or variable after '+'");
       }
@@ -1360,7 +1973,7 @@ public:
 
     // check if next token is '=' operator
     // if it is, chain variable assignment
-    if (lexer.Any() && lexer.Peek() == Lexer::ID_ASSIGN) {
+    if (lexer.Any() && lexer.PeekId() == Lexer::ID_ASSIGN) {
       Token middle = next;
       next = lexer.Use(); // consume '='
 
@@ -1370,37 +1983,74 @@ public:
         // handle chaining logic
         //var_token, middle, next2
         if (middle == Lexer::ID_ID) {
-          current_scope[middle.lexeme] = TokenToString(next2);
-          symbolDeclarationLines[middle.lexeme] = middle.line_id;
+          Value & chained = current_scope[std::string(middle.lexeme)];
+          cse.Forget(chained);
+          DropCold(chained);
+          chained = TokenToString(next2);
+          symbolDeclarationLines[std::string(middle.lexeme)] = middle.line_id;
           result = TokenToString(next2);
         }
       }
     }
 
-    current_scope[var_name] = result;
-    symbolDeclarationLines[var_name] = var_token.line_id;
+    trace::Assign(var_token.line_id, var_name, result);
+    current_scope[std::string(var_name)] = std::move(result);
+    symbolDeclarationLines[std::string(var_name)] = var_token.line_id;
+  }
+
+  // Innermost variable called 'name', or nullptr if none is in scope.  Map
+  // entries stay put, so the pointer stays valid until its scope closes.
+  Value * FindVariable(std::string_view name) {
+    for (auto scope_it = symbol_stack.rbegin(); scope_it != symbol_stack.rend(); ++scope_it) {
+      auto it = scope_it->find(name);
+      if (it == scope_it->end()) continue;
+      if (cold_after) Touch(it->second);
+      return &it->second;
+    }
+    return nullptr;
+  }
+
+  // READ name: set an existing variable to the next line of standard input.
+  // At end of input it is set to "" and false is returned, which is how
+  // "WHILE (READ line)" knows to stop.
+  bool ProcessREAD(const Token & token) {
+    if (!lexer.Any() || lexer.PeekId() != Lexer::ID_ID) {
+      Error(token, "Expected variable name after READ");
+    }
+    const Token var_token = lexer.Use();
+    Value * target = FindVariable(var_token.lexeme);
+    if (!target) {
+      RuntimeError(var_token, "READ into undeclared variable '", var_token.lexeme, "'");
+    }
+
+    cse.Forget(*target);
+    const bool found = ReadLine(*target);
+    trace::Assign(var_token.line_id, var_token.lexeme, *target);
+    return found;
+  }
+
+  // Set 'target' to the next line of input, or to "" (returning false) at the end.
+  bool ReadLine(Value & target) {
+    std::string_view line;
+    const bool found = input.Next(line);
+    target = found ? Value(line) : Value();
+    return found;
   }
 
   void ProcessID(const Token & token) {
     // check if id is in the symbol_table
     // if not, throw an error
     bool reverse = false;
-    std::string name = token.lexeme;
-    bool found = false;
-    for (auto scope_it = symbol_stack.rbegin(); scope_it != symbol_stack.rend(); ++scope_it) {
-      if (scope_it->find(name) != scope_it->end()) {
-        found = true;
-        break;
-      }
-    }
-    if (!found) {
-      Error(token, "Assignment to undeclared variable '", name, "'");
+    const std::string_view name = token.lexeme;
+    Value * target = FindVariable(name);
+    if (!target) {
+      RuntimeError(token, "Assignment to undeclared variable '", name, "'");
     }
 
-    if (!lexer.Any() || lexer.Peek() != Lexer::ID_ASSIGN) {
+    if (!lexer.Any() || lexer.PeekId() != Lexer::ID_ASSIGN) {
       Error(token, "Expected '=' after variable name");
     }
-    lexer.Use();
+    lexer.Skip();
 
     // if it is:
       // check if it is a simple x = y, or a more complex expression(like in CompleteCalculation)
@@ -1417,57 +2067,293 @@ public:
       first = lexer.Use();
     }
 
-    std::string value;
-    if (first == Lexer::ID_ID || first == Lexer::ID_LIT_STRING) {
-      if (lexer.Any() && (
-        lexer.Peek() == Lexer::ID_PLUS || lexer.Peek() == Lexer::ID_MINUS ||
-        lexer.Peek() == Lexer::ID_SLASH || lexer.Peek() == Lexer::ID_PERCENT)) {
-
-        value = CompleteCalculation(first);
-      } else {
-        value = TokenToString(first);
-      }
+    Value value;
+    if (IsSelfUpdate(name, first)) {
+      // Take the stored value so it is the only reference to its buffer;
+      // appends then grow it in place instead of copying it every time.
+      Value current = std::move(*target);
+      trace::Read(first.line_id, name, current);
+      value = ParseExpr(first, &current);
+    } else if (first == Lexer::ID_ID || first == Lexer::ID_LIT_STRING || first == Lexer::ID_LPAREN) {
+      value = CompleteCalculation(first);
     } else {
-      Error(first, "Expected identifier or string literal after '='");
+      Error(first, "Expected identifier, string literal, or expression after '='");
     }
 
     if (reverse) {
-      if (value == "") {
-        value = " ";
-      }
-      else {
-        value = "";
-      }
-    }
-    for (auto scope_it = symbol_stack.rbegin(); scope_it != symbol_stack.rend(); ++scope_it) {
-      if (scope_it->find(name) != scope_it->end()) {
-        (*scope_it)[name] = value;
-        break;
-      }
+      value = (value.empty()) ? "1" : "";
     }
+    trace::Assign(token.line_id, name, value);
+    cse.Forget(*target);
+    *target = std::move(value);
+  }
+
+  // Stop the program if it has used up any of its budgets.  Only called at
+  // WHILE backedges, the one place a program can keep running indefinitely.
+  void CheckBudgets(const Token & token) {
+    if (WithinBudgets()) return;
+    const uint64_t steps = counters.statements;
+    if (steps > step_limit) {
+      ThrowDiagnostic(DiagnosticKind::StepLimit, token.line_id, token.column,
+                      "Step limit exceeded: more than ", limits.max_steps,
+                      " statements run (see --max-steps)");
+    }
+    if (Value::LiveBytes() > memory_limit) {
+      ThrowDiagnostic(DiagnosticKind::MemoryLimit, token.line_id, token.column,
+                      "Memory limit exceeded: values hold ", Value::LiveBytes(),
+                      " bytes, limit is ", limits.max_memory, " (see --max-memory)");
+    }
+    ThrowDiagnostic(DiagnosticKind::Timeout, token.line_id, token.column,
+                    "Time limit exceeded: still running after ", limits.timeout,
+                    " seconds (see --timeout)");
+  }
+
+  bool WithinBudgets() const {
+    return counters.statements <= step_limit && Value::LiveBytes() <= memory_limit && !watchdog.Expired();
   }
 
-  void ProcessLBRACE() {
+  void ProcessLBRACE(const Token & token) {
+    PushFrame({ .type = FrameType::SCOPE, .token = token });
     symbol_stack.push_back({});
+    ++counters.scope_pushes;
   }
 
+  // Close the innermost block.  At the end of a WHILE body this jumps back to
+  // re-test the condition instead.
   void ProcessRBRACE(const Token & token) {
-    if (symbol_stack.size() <= 1) {
+    if (frames.empty()) {
       Error(token, "Extra '}' without matching '{'");
     }
-    symbol_stack.pop_back();
+    Frame & frame = frames.back();
+    switch (frame.type) {
+      case FrameType::SCOPE:
+        if (!cold.empty()) for (const auto & [name, value] : symbol_stack.back()) DropCold(value);
+        symbol_stack.pop_back();
+        ++counters.scope_pops;
+        break;
+      case FrameType::IF:       // An ELSE after the block pairs with this IF.
+        lastIfCondition = true;
+        justProcessedIf = true;
+        break;
+      case FrameType::ELSE:
+        justProcessedIf = false;
+        break;
+      case FrameType::WHILE:
+        if (frame.end_pos == 0) frame.end_pos = lexer.GetPos();
+        CheckBudgets(frame.token);
+        if (frame.iterations == jit_threshold && JitEnabled() && TierUp(frame)) return;
+        lexer.SetPos(frame.cond_pos);
+        if (TestWHILECondition(frame.token)) {
+          trace::Loop(frame.token.line_id, ++frame.iterations);
+          return;               // Back at the top of the body.
+        }
+        trace::LoopEnd(frame.token.line_id, frame.iterations);
+        if (JitEnabled()) jit_loops[frame.cond_pos].iterations += frame.iterations;
+        lexer.SetPos(frame.end_pos);
+        break;
+    }
+    frames.pop_back();
+    EndStatement();
   }
 };
 
+// Run one step of the program, reporting (but surviving) any error.
+template <typename FUN>
+static void RunReportingErrors(FUN && fun) {
+  try {
+    fun();
+  } catch (const Diagnostic & diag) {
+    std::cout.flush();
+    std::cerr << diag.what() << std::endl;
+  }
+  std::cout.flush();
+}
+
+// --watch: run the program, then again every time its file is saved.  Only
+// the lines that changed are lexed again.  Runs until interrupted.
+static int RunWatching(StringStackPlusPlus & prog, const std::string & filename) {
+  using clock = std::chrono::steady_clock;
+  auto ms = [](clock::duration time) { return std::chrono::duration<double, std::milli>(time).count(); };
+
+  FileWatcher watcher(filename);
+  if (!watcher.Ok()) {
+    std::cerr << "ERROR: unable to watch '" << filename << "'" << std::endl;
+    return 1;
+  }
+  RunReportingErrors([&] { prog.Run(); });
+
+  clock::time_point changed_at;
+  while (watcher.Wait(changed_at)) {
+    std::ifstream fs(filename);
+    if (!fs) continue;     // Replaced mid-save; its next event will follow.
+    std::string source(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>{});
+
+    const clock::time_point start = clock::now();
+    clock::time_point lexed = start;
+    size_t lines = 0;
+    std::cerr << "[watch] " << filename << " changed; running again" << std::endl;
+    RunReportingErrors([&] {
+      lines = prog.Reload(std::move(source));
+      lexed = clock::now();
+      prog.Execute();
+    });
+    const clock::time_point done = clock::now();
+    std::cerr << std::fixed << std::setprecision(1) << "[watch] re-lexed " << lines << " line(s) in " << ms(lexed - start)
+              << " ms, ran in " << ms(done - lexed) << " ms; save to output "
+              << ms(done - changed_at) << " ms" << std::endl;
+  }
+  std::cerr << "ERROR: lost the watch on '" << filename << "'" << std::endl;
+  return 1;
+}
+
 int main(int argc, char * argv[])
 {
-  if (argc != 2) {
-    std::cout << "Format: " << argv[0] << " [filename]" << std::endl;
+  std::string filename;
+  std::string trace_path;
+  std::string stats_path;          // "-" for stderr
+  size_t max_depth = StringStackPlusPlus::DEFAULT_MAX_DEPTH;
+  Limits limits;
+  bool watch = false;
+  bool use_cse = true;
+  size_t jit_threshold = StringStackPlusPlus::DEFAULT_JIT_THRESHOLD;
+  size_t compress_cold = 0;
+  bool async_output = false;
+  double checkpoint_every = 0.0;
+  std::string checkpoint_path;
+  std::string restore_path;
+  size_t jobs = 1;
+  bool bad_args = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--trace" && i + 1 < argc) trace_path = argv[++i];
+    else if (arg == "--stats") stats_path = "-";
+    else if (arg == "--watch") watch = true;
+    else if (arg == "--no-cse") use_cse = false;
+    else if (arg == "--jit") jit_threshold = StringStackPlusPlus::JIT_ALWAYS;
+    else if (arg == "--no-jit") jit_threshold = StringStackPlusPlus::JIT_NEVER;
+    else if (arg == "--jit-threshold" && i + 1 < argc) bad_args |= !ParseCount(argv[++i], jit_threshold);
+    else if (arg == "--compress-cold" && i + 1 < argc) bad_args |= !ParseCount(argv[++i], compress_cold);
+    else if (arg == "--async-output") async_output = true;
+    else if (arg == "--checkpoint-every" && i + 1 < argc) bad_args |= !ParseSeconds(argv[++i], checkpoint_every);
+    else if (arg == "--checkpoint-file" && i + 1 < argc) checkpoint_path = argv[++i];
+    else if (arg == "--restore" && i + 1 < argc) restore_path = argv[++i];
+    else if (arg == "--jobs" && i + 1 < argc) bad_args |= !ParseCount(argv[++i], jobs);
+    else if (arg == "--stats-file" && i + 1 < argc) stats_path = argv[++i];
+    else if (arg == "--max-depth" && i + 1 < argc) bad_args |= !ParseCount(argv[++i], max_depth);
+    else if (arg == "--max-steps" && i + 1 < argc) bad_args |= !ParseCount(argv[++i], limits.max_steps);
+    else if (arg == "--max-memory" && i + 1 < argc) bad_args |= !ParseBytes(argv[++i], limits.max_memory);
+    else if (arg == "--timeout" && i + 1 < argc) bad_args |= !ParseSeconds(argv[++i], limits.timeout);
+    else if (arg.starts_with("--") || !filename.empty()) bad_args = true;
+    else filename = arg;
+  }
+  if (bad_args || filename.empty()) {
+    std::cout << "Format: " << argv[0] << " [options] [filename]\n"
+              << "Options:\n"
+              << "  --max-depth N   Limit nesting of blocks and parentheses (default "
+              << StringStackPlusPlus::DEFAULT_MAX_DEPTH << ")\n"
+              << "  --max-steps N   Stop (exit status 3) after N statements\n"
+              << "  --max-memory N  Stop (exit status 4) once values hold N bytes (K/M/G suffixes allowed)\n"
+              << "  --timeout SECS  Stop (exit status 5) after SECS seconds\n"
+              << "  --stats         Print runtime statistics as JSON to stderr on exit\n"
+              << "  --stats-file F  Write the same statistics to file F instead\n"
+              << "  --jobs N        Run independent top-level statements on N threads\n"
+              << "  --no-cse        Recompute repeated expressions instead of reusing results\n"
+              << "  --jit-threshold N\n"
+              << "                  Compile a WHILE loop to machine code once it has run N iterations\n"
+              << "                  (default " << StringStackPlusPlus::DEFAULT_JIT_THRESHOLD << "; x86-64 only)\n"
+              << "  --jit           Compile every WHILE loop before it first runs\n"
+              << "  --no-jit        Always interpret\n"
+              << "  --compress-cold N\n"
+              << "                  Compress variables of " << StringStackPlusPlus::COLD_MIN_SIZE / 1024
+              << "K or more left unused for N statements\n"
+              << "  --async-output  Write program output from a background thread\n"
+              << "  --watch         Run again each time the file is saved (until interrupted)\n"
+              << "  --checkpoint-every SECS\n"
+              << "                  Save the program's state every SECS seconds, to FILENAME.checkpoint\n"
+              << "  --checkpoint-file F\n"
+              << "                  Save checkpoints to file F instead\n"
+              << "  --restore F     Resume from checkpoint file F instead of starting over\n"
+              << "  --trace FILE    Record an execution trace (builds from 'make trace')"
+              << std::endl;
     exit(1);
   }
 
-  StringStackPlusPlus prog(argv[1]);
-  prog.Run();
+  if (!trace_path.empty()) {
+    if constexpr (!trace::enabled) {
+      std::cerr << "ERROR: tracing is not compiled in; rebuild with 'make trace'" << std::endl;
+      exit(1);
+    } else {
+      trace::GetRing().Start(trace_path);
+    }
+  }
 
-  return 0;
+  // Declared before the program so that it outlives it: all output has been
+  // written by the time main() returns.
+  std::optional<AsyncOutput> writer;
+  if (async_output) writer.emplace(STDOUT_FILENO, std::cout);
+
+  StringStackPlusPlus prog(filename);
+  prog.SetMaxDepth(max_depth);
+  prog.SetLimits(limits);
+  prog.SetCse(use_cse);
+  prog.SetJitThreshold(jit_threshold);
+  prog.SetCompressCold(compress_cold);
+  prog.SetJobs(jobs);
+  prog.SetCheckpoints(checkpoint_path.empty() ? filename + ".checkpoint" : checkpoint_path, checkpoint_every);
+  if (watch) return RunWatching(prog, filename);
+
+  checkpoint::Snapshot snap;
+  std::string restore_error;
+  if (!restore_path.empty() && !checkpoint::Read(restore_path, snap, restore_error)) {
+    std::cerr << "ERROR: " << restore_error << std::endl;
+    return 1;
+  }
+  int exit_code = 0;
+  const auto start = std::chrono::steady_clock::now();
+  try {
+    if (restore_path.empty()) {
+      prog.Run();
+    } else {
+      prog.Load();
+      if (!prog.Resume(std::move(snap), restore_error)) {
+        std::cerr << "ERROR: " << restore_error << std::endl;
+        return 1;
+      }
+    }
+  } catch (const Diagnostic & diag) {
+    // Program output is buffered; make sure it lands before the error message.
+    std::cout.flush();
+    std::cerr << diag.what() << std::endl;
+    exit_code = diag.ExitCode();
+  }
+
+  if constexpr (trace::enabled) {
+    if (!trace::GetRing().Write()) {
+      std::cerr << "ERROR: unable to write trace file '" << trace_path << "'" << std::endl;
+      if (exit_code == 0) exit_code = 1;
+    }
+  }
+
+  if (!stats_path.empty()) {
+    const stats::Summary summary{
+      .peak_value_bytes = Value::PeakBytes(),
+      .live_value_bytes = Value::LiveBytes(),
+      .seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+      .exit_status = exit_code,
+      .jit_threshold = prog.GetJitThreshold(),
+      .compress_cold = prog.GetCompressCold(),
+    };
+    std::cout.flush();
+    if (stats_path == "-") {
+      stats::WriteJson(std::cerr, prog.GetCounters(), summary);
+    } else {
+      std::ofstream out(stats_path);
+      stats::WriteJson(out, prog.GetCounters(), summary);
+      if (!out) {
+        std::cerr << "ERROR: unable to write stats file '" << stats_path << "'" << std::endl;
+        if (exit_code == 0) exit_code = 1;
+      }
+    }
+  }
+  return exit_code;
 }
@@ -0,0 +1,141 @@
+#pragma once
+
+// Substring search used by the -, /, % and ? operators.
+//
+// Short needles use a SIMD first/last-byte filter: candidate positions are
+// found 16 at a time by matching both the first and the last needle byte, and
+// only those candidates are compared in full.  Long needles searched in large
+// haystacks use Boyer-Moore-Horspool keyed on the last two bytes of the window
+// (single bytes give tiny shifts on low-entropy text such as logs); the
+// preprocessed shift table can be reused across searches through a NeedleCache.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace search {
+  constexpr size_t npos = std::string_view::npos;
+
+  // Needles at least this long, in haystacks at least HORSPOOL_MIN_HAYSTACK
+  // long, are searched with Horspool; everything else uses FindShort().
+  constexpr size_t HORSPOOL_MIN_NEEDLE = 256;
+  constexpr size_t HORSPOOL_MIN_HAYSTACK = 4096;
+
+  inline bool UseHorspool(size_t hay_size, size_t needle_size) {
+    return needle_size >= HORSPOOL_MIN_NEEDLE && hay_size >= HORSPOOL_MIN_HAYSTACK;
+  }
+
+  // First/last-byte filtered search; good for short needles.
+  inline size_t FindShort(std::string_view hay, std::string_view needle) {
+    const size_t n = hay.size();
+    const size_t m = needle.size();
+    if (m == 0) return 0;
+    if (m > n) return npos;
+
+    const char * h = hay.data();
+    const char * p = needle.data();
+    if (m == 1) {
+      const void * found = std::memchr(h, p[0], n);
+      return found ? static_cast<size_t>(static_cast<const char *>(found) - h) : npos;
+    }
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(p[0]);
+    const __m128i last = _mm_set1_epi8(p[m-1]);
+    for (; i + m - 1 + 16 <= n; i += 16) {
+      const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i));
+      const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i + m - 1));
+      unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last))));
+      while (mask) {
+        const size_t pos = i + static_cast<size_t>(__builtin_ctz(mask));
+        if (std::memcmp(h + pos + 1, p + 1, m - 2) == 0) return pos;
+        mask &= mask - 1;
+      }
+    }
+#endif
+    // Remaining tail (or the whole search without SSE2).
+    for (; i + m <= n; ++i) {
+      if (h[i] == p[0] && h[i + m - 1] == p[m-1] && std::memcmp(h + i, p, m) == 0) return i;
+    }
+    return npos;
+  }
+
+  // A needle preprocessed for (bigram) Boyer-Moore-Horspool.
+  class Searcher {
+  private:
+    static constexpr size_t TABLE_SIZE = 4096;
+
+    std::string pattern;
+    std::array<uint32_t, TABLE_SIZE> shift{};   // Slide distance per hashed window-end bigram.
+
+    static size_t Key(char a, char b) {
+      return ((static_cast<size_t>(static_cast<unsigned char>(a)) << 4)
+              ^ static_cast<unsigned char>(b)) & (TABLE_SIZE - 1);
+    }
+
+  public:
+    Searcher() = default;
+    explicit Searcher(std::string_view needle) : pattern(needle) {
+      const size_t m = pattern.size();
+      if (m < 2) return;
+      // A bigram that does not occur in the needle (outside its final
+      // position) lets the window slide by m-1; otherwise slide to line up
+      // its rightmost occurrence.  Hash collisions only make shifts smaller.
+      shift.fill(static_cast<uint32_t>(m - 1));
+      for (size_t k = 1; k + 1 < m; ++k) {
+        shift[Key(pattern[k-1], pattern[k])] = static_cast<uint32_t>(m - 1 - k);
+      }
+    }
+
+    std::string_view Pattern() const { return pattern; }
+
+    size_t Find(std::string_view hay) const {
+      const size_t n = hay.size();
+      const size_t m = pattern.size();
+      if (!UseHorspool(n, m)) return FindShort(hay, pattern);
+
+      const char * h = hay.data();
+      const char * p = pattern.data();
+      for (size_t i = 0; i <= n - m; ) {
+        const char * window_end = h + i + m - 1;
+        if (window_end[0] == p[m-1] && window_end[-1] == p[m-2] &&
+            std::memcmp(h + i, p, m - 2) == 0) return i;
+        i += std::max<size_t>(1, shift[Key(window_end[-1], window_end[0])]);
+      }
+      return npos;
+    }
+  };
+
+  // One-off search, picking the algorithm from the sizes involved.
+  inline size_t Find(std::string_view hay, std::string_view needle) {
+    if (UseHorspool(hay.size(), needle.size())) return Searcher(needle).Find(hay);
+    return FindShort(hay, needle);
+  }
+
+  // Remembers preprocessed needles so a literal searched for repeatedly (for
+  // example inside a WHILE body) is only preprocessed once.  Direct-mapped and
+  // bounded: a colliding needle simply replaces the old entry.
+  class NeedleCache {
+  private:
+    static constexpr size_t NUM_SLOTS = 64;
+    std::array<Searcher, NUM_SLOTS> slots{};
+
+  public:
+    size_t Find(std::string_view hay, std::string_view needle) {
+      if (!UseHorspool(hay.size(), needle.size())) return FindShort(hay, needle);
+      Searcher & entry = slots[std::hash<std::string_view>{}(needle) % NUM_SLOTS];
+      if (entry.Pattern() != needle) entry = Searcher(needle);
+      return entry.Find(hay);
+    }
+  };
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+// Runtime statistics (--stats, --stats-file).
+//
+// The interpreter bumps these plain counters as it runs; at exit they are
+// combined with value-memory and process-level figures and written as one
+// JSON object for monitoring to scrape.  Heap allocation totals come from
+// AllocCounter.hpp and are null unless it was compiled in (make allocs).
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <sys/resource.h>
+
+#include "AllocCounter.hpp"
+
+namespace stats {
+  // Arithmetic operators, in the order they are reported.
+  enum Operator { PLUS, MINUS, SLASH, PERCENT, NUM_OPERATORS };
+  constexpr const char * OPERATOR_NAMES[NUM_OPERATORS] = { "+", "-", "/", "%" };
+
+  // Conditions: the six comparisons, '?' (contains) and a bare truth test.
+  enum Comparison { EQ, NEQ, LT, LE, GT, GE, CONTAINS, TRUTHY, NUM_COMPARISONS };
+  constexpr const char * COMPARISON_NAMES[NUM_COMPARISONS] =
+    { "==", "!=", "<", "<=", ">", ">=", "?", "truthy" };
+
+  struct Counters {
+    uint64_t tokens = 0;          // Tokens produced by the lexer
+    uint64_t statements = 0;      // Statements started
+    std::array<uint64_t, NUM_OPERATORS> operators{};
+    uint64_t reused_results = 0;  // Operators skipped by reusing an earlier result
+    std::array<uint64_t, NUM_COMPARISONS> comparisons{};
+    uint64_t scope_pushes = 0;    // Bare '{' blocks opened...
+    uint64_t scope_pops = 0;      // ...and closed
+    uint64_t parallel_statements = 0;   // Statements run on worker threads (--jobs)
+    uint64_t loops_compiled = 0;  // WHILE loops compiled to machine code...
+    uint64_t loops_rejected = 0;  // ...or found not to be compilable
+    uint64_t tier_ups = 0;        // Loops switched to compiled code part way through
+    uint64_t values_compressed = 0;     // Cold variables compressed (--compress-cold)...
+    uint64_t values_restored = 0;       // ...and restored on their next use
+    uint64_t peak_cold_saved = 0;       // Most bytes saved by compression at once
+    uint64_t compress_nanoseconds = 0;
+    uint64_t restore_nanoseconds = 0;
+
+    // Fold in the counts from a worker (--jobs).
+    Counters & operator+=(const Counters & in) {
+      tokens += in.tokens;
+      statements += in.statements;
+      for (size_t i = 0; i < NUM_OPERATORS; ++i) operators[i] += in.operators[i];
+      reused_results += in.reused_results;
+      for (size_t i = 0; i < NUM_COMPARISONS; ++i) comparisons[i] += in.comparisons[i];
+      scope_pushes += in.scope_pushes;
+      scope_pops += in.scope_pops;
+      parallel_statements += in.parallel_statements;
+      loops_compiled += in.loops_compiled;
+      loops_rejected += in.loops_rejected;
+      tier_ups += in.tier_ups;
+      values_compressed += in.values_compressed;
+      values_restored += in.values_restored;
+      peak_cold_saved = std::max(peak_cold_saved, in.peak_cold_saved);
+      compress_nanoseconds += in.compress_nanoseconds;
+      restore_nanoseconds += in.restore_nanoseconds;
+      return *this;
+    }
+  };
+
+  // Figures gathered once the program has finished.
+  struct Summary {
+    size_t peak_value_bytes = 0;
+    size_t live_value_bytes = 0;
+    double seconds = 0.0;
+    int exit_status = 0;
+    std::optional<size_t> jit_threshold;   // Loop iterations before compiling; none if never
+    std::optional<size_t> compress_cold;   // Unused statements before compressing; none if never
+  };
+
+  // Largest resident set size of this process so far, in bytes.
+  inline size_t PeakRSS() {
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;   // Linux reports KiB.
+  }
+
+  inline void WriteJson(std::ostream & out, const Counters & counters, const Summary & summary) {
+    out << "{\n"
+        << "  \"exit_status\": " << summary.exit_status << ",\n"
+        << "  \"seconds\": " << summary.seconds << ",\n"
+        << "  \"tokens\": " << counters.tokens << ",\n"
+        << "  \"statements\": " << counters.statements << ",\n"
+        << "  \"operators\": {";
+    for (size_t i = 0; i < NUM_OPERATORS; ++i) {
+      out << (i ? ", " : " ") << '"' << OPERATOR_NAMES[i] << "\": " << counters.operators[i];
+    }
+    out << " },\n  \"reused_results\": " << counters.reused_results << ",\n  \"comparisons\": {";
+    for (size_t i = 0; i < NUM_COMPARISONS; ++i) {
+      out << (i ? ", " : " ") << '"' << COMPARISON_NAMES[i] << "\": " << counters.comparisons[i];
+    }
+    out << " },\n"
+        << "  \"scopes\": { \"pushed\": " << counters.scope_pushes
+        << ", \"popped\": " << counters.scope_pops << " },\n"
+        << "  \"parallel_statements\": " << counters.parallel_statements << ",\n"
+        << "  \"jit\": { \"threshold\": ";
+    if (summary.jit_threshold) out << *summary.jit_threshold;
+    else out << "null";
+    out << ", \"compiled\": " << counters.loops_compiled
+        << ", \"rejected\": " << counters.loops_rejected
+        << ", \"tier_ups\": " << counters.tier_ups << " },\n"
+        << "  \"cold\": { \"after\": ";
+    if (summary.compress_cold) out << *summary.compress_cold;
+    else out << "null";
+    out << ", \"compressed\": " << counters.values_compressed
+        << ", \"restored\": " << counters.values_restored
+        << ", \"peak_saved_bytes\": " << counters.peak_cold_saved
+        << ", \"compress_seconds\": " << counters.compress_nanoseconds / 1e9
+        << ", \"restore_seconds\": " << counters.restore_nanoseconds / 1e9 << " },\n"
+        << "  \"value_bytes\": { \"peak\": " << summary.peak_value_bytes
+        << ", \"live\": " << summary.live_value_bytes << " },\n"
+        << "  \"heap\": ";
+    if constexpr (alloc_counter::enabled) {
+      out << "{ \"allocations\": " << alloc_counter::count.load()
+          << ", \"bytes\": " << alloc_counter::bytes.load() << " },\n";
+    } else {
+      out << "{ \"allocations\": null, \"bytes\": null },\n";
+    }
+    out << "  \"peak_rss_bytes\": " << PeakRSS() << "\n"
+        << "}" << std::endl;
+  }
+}
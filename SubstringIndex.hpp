@@ -0,0 +1,115 @@
+#pragma once
+
+// Suffix-array index over one large string, used to answer repeated
+// substring queries against the same value in O(m log n).
+//
+// Values build one lazily (see Value::SearchIndex()) once they are large and
+// have been searched several times; the index lives alongside the value's
+// heap block and is thrown away whenever the characters change.
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+class SubstringIndex {
+public:
+  static constexpr size_t npos = std::string_view::npos;
+  static constexpr size_t UNKNOWN = npos - 1;   // Too many matches to pick the first cheaply.
+
+  // Strings at least this long may be indexed...
+  static constexpr size_t MIN_SIZE = 64 * 1024;
+  // ...but not beyond this: the build needs 12 bytes per character, and a
+  // parallel scan (see Parallel.hpp) is the better deal for huge values.
+  static constexpr size_t MAX_SIZE = 256 << 20;
+  // ...once they have been searched this many times.
+  static constexpr uint32_t MIN_SEARCHES = 8;
+  // Largest match range scanned for the leftmost occurrence.
+  static constexpr size_t MAX_CANDIDATES = 64;
+
+private:
+  std::vector<uint32_t> suffixes;   // Start positions, in sorted suffix order.
+
+  // Compare the suffix at 'pos' (cut to the needle's length) with 'needle'.
+  static int Compare(std::string_view text, uint32_t pos, std::string_view needle) {
+    return text.substr(pos, needle.size()).compare(needle);
+  }
+
+  // Range [first, last) of suffixes that start with 'needle'.
+  std::pair<size_t, size_t> Range(std::string_view text, std::string_view needle) const {
+    auto first = std::partition_point(suffixes.begin(), suffixes.end(),
+      [&](uint32_t pos) { return Compare(text, pos, needle) < 0; });
+    auto last = std::partition_point(first, suffixes.end(),
+      [&](uint32_t pos) { return Compare(text, pos, needle) == 0; });
+    return { static_cast<size_t>(first - suffixes.begin()),
+             static_cast<size_t>(last - suffixes.begin()) };
+  }
+
+public:
+  // Build by prefix doubling: each round sorts suffixes by their first 2k
+  // characters using the ranks from the previous round as radix keys.
+  explicit SubstringIndex(std::string_view text) {
+    const size_t n = text.size();
+    suffixes.resize(n);
+    if (n == 0) return;
+
+    std::vector<uint32_t> rank(n), next_rank(n), order(n);
+    std::vector<uint32_t> counts(std::max<size_t>(n, 256) + 1);
+
+    // Initial ranks are the characters themselves.
+    for (size_t i = 0; i < n; ++i) rank[i] = static_cast<unsigned char>(text[i]);
+    for (size_t i = 0; i < n; ++i) ++counts[rank[i] + 1];
+    for (size_t i = 1; i < counts.size(); ++i) counts[i] += counts[i-1];
+    for (size_t i = 0; i < n; ++i) suffixes[counts[rank[i]]++] = static_cast<uint32_t>(i);
+    size_t classes = 1;
+    next_rank[suffixes[0]] = 0;
+    for (size_t i = 1; i < n; ++i) {
+      if (rank[suffixes[i]] != rank[suffixes[i-1]]) ++classes;
+      next_rank[suffixes[i]] = static_cast<uint32_t>(classes - 1);
+    }
+    rank.swap(next_rank);
+
+    for (size_t k = 1; classes < n; k *= 2) {
+      // Order by second key: suffixes with nothing k characters on come first.
+      size_t out = 0;
+      for (size_t i = n - std::min(k, n); i < n; ++i) order[out++] = static_cast<uint32_t>(i);
+      for (uint32_t pos : suffixes) if (pos >= k) order[out++] = static_cast<uint32_t>(pos - k);
+
+      // Stable counting sort by first key.
+      std::fill(counts.begin(), counts.begin() + classes + 1, 0);
+      for (size_t i = 0; i < n; ++i) ++counts[rank[i] + 1];
+      for (size_t i = 1; i <= classes; ++i) counts[i] += counts[i-1];
+      for (uint32_t pos : order) suffixes[counts[rank[pos]]++] = pos;
+
+      // Re-rank by the (first, second) key pair.
+      auto second = [&](uint32_t pos) -> int64_t { return pos + k < n ? rank[pos + k] : -1; };
+      classes = 1;
+      next_rank[suffixes[0]] = 0;
+      for (size_t i = 1; i < n; ++i) {
+        const uint32_t a = suffixes[i-1], b = suffixes[i];
+        if (rank[a] != rank[b] || second(a) != second(b)) ++classes;
+        next_rank[b] = static_cast<uint32_t>(classes - 1);
+      }
+      rank.swap(next_rank);
+    }
+  }
+
+  // Does 'needle' occur in 'text'?  'text' must be the string indexed.
+  bool Contains(std::string_view text, std::string_view needle) const {
+    if (needle.empty()) return true;
+    auto [first, last] = Range(text, needle);
+    return first < last;
+  }
+
+  // Leftmost position of 'needle' in 'text', npos if absent, or UNKNOWN when
+  // it occurs so often that a linear search will find it sooner.
+  size_t Find(std::string_view text, std::string_view needle) const {
+    if (needle.empty()) return 0;
+    auto [first, last] = Range(text, needle);
+    if (first == last) return npos;
+    if (last - first > MAX_CANDIDATES) return UNKNOWN;
+    return *std::min_element(suffixes.begin() + first, suffixes.begin() + last);
+  }
+
+  size_t MemoryBytes() const { return suffixes.capacity() * sizeof(uint32_t); }
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+// A fixed set of worker threads for running loops in parallel.
+//
+// ParallelFor() hands out task indices from a shared counter until they run
+// out, so uneven tasks balance themselves.  The calling thread takes part as
+// worker 0, which means a pool of size 1 has no threads at all and simply
+// runs the loop in place.  The pool runs one loop at a time: a loop started
+// from inside a task, or while another thread's loop is running, also runs in
+// place rather than waiting for workers that may never come free.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+private:
+  using Task = std::function<void(size_t task, size_t worker)>;
+
+  std::vector<std::jthread> threads;
+  std::mutex mutex;
+  std::condition_variable wake;      // A new loop has started (or we are stopping)
+  std::condition_variable finished;  // All helpers are done with the current loop
+
+  // The loop being run; only changed while no helper is working on it.
+  const Task * task = nullptr;
+  size_t count = 0;
+  std::atomic<size_t> next{0};
+  uint64_t generation = 0;
+  size_t busy = 0;                   // Helpers still working on this generation
+  bool stopping = false;
+  std::mutex running;                // Held by the thread whose loop is running
+
+  static inline thread_local bool in_task = false;   // This thread is running a task
+
+  void Work(size_t worker) {
+    in_task = true;
+    for (size_t i = next.fetch_add(1, std::memory_order_relaxed); i < count;
+         i = next.fetch_add(1, std::memory_order_relaxed)) {
+      (*task)(i, worker);
+    }
+    in_task = false;
+  }
+
+  void HelperLoop(size_t worker) {
+    uint64_t seen = 0;
+    std::unique_lock lock(mutex);
+    while (true) {
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) return;
+      seen = generation;
+      lock.unlock();
+      Work(worker);
+      lock.lock();
+      if (--busy == 0) finished.notify_one();
+    }
+  }
+
+public:
+  explicit ThreadPool(size_t size) {
+    for (size_t worker = 1; worker < std::max<size_t>(size, 1); ++worker) {
+      threads.emplace_back([this, worker] { HelperLoop(worker); });
+    }
+  }
+
+  ~ThreadPool() {
+    { std::lock_guard lock(mutex); stopping = true; }
+    wake.notify_all();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+
+  // One pool per process with a worker per core, for kernels that split up
+  // a single large operation.  It is built, and its threads started, the
+  // first time this is called.
+  static ThreadPool & Shared() {
+    static ThreadPool pool(std::max<size_t>(std::thread::hardware_concurrency(), 1));
+    return pool;
+  }
+
+  // Number of workers, including the calling thread.
+  size_t Size() const { return threads.size() + 1; }
+
+  // Call fun(i, worker) for every i in [0, n) and wait for all of them.
+  // 'worker' is below Size() and no two calls running at once share it, so
+  // it can index per-worker scratch space.  'fun' must not throw.
+  void ParallelFor(size_t n, const Task & fun) {
+    std::unique_lock owner(running, std::defer_lock);
+    if (threads.empty() || n <= 1 || in_task || !owner.try_lock()) {
+      for (size_t i = 0; i < n; ++i) fun(i, 0);
+      return;
+    }
+    {
+      std::lock_guard lock(mutex);
+      task = &fun;
+      count = n;
+      next.store(0, std::memory_order_relaxed);
+      busy = threads.size();
+      ++generation;
+    }
+    wake.notify_all();
+    Work(0);
+    std::unique_lock lock(mutex);
+    finished.wait(lock, [&] { return busy == 0; });
+    task = nullptr;
+  }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+// Opt-in execution tracing.
+//
+// Build with -DSSTACK_TRACE (or "make trace") and run with "--trace FILE" to
+// record executed statements, variable reads and writes, IF/ELSE decisions
+// and WHILE iterations into a fixed-size ring buffer.  The buffer is written
+// to FILE when the program finishes (or stops on an error); decode it with
+// tools/trace_decode.  Without the flag every hook below compiles to nothing.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace trace {
+#ifdef SSTACK_TRACE
+  constexpr bool enabled = true;
+#else
+  constexpr bool enabled = false;
+#endif
+
+  enum class Kind : uint8_t {
+    Statement = 1,  // name: first word of the statement
+    Read,           // name: variable, text: value, number: value size
+    Assign,         // name: variable, text: new value, number: value size
+    Branch,         // name: "IF" or "ELSE", number: 1 if its block runs
+    Loop,           // number: iteration about to run (from 1)
+    LoopEnd,        // number: total iterations
+  };
+
+  // One fixed-size event; long names and values are cut short.
+  struct Record {
+    Kind kind;
+    uint8_t name_size;
+    uint8_t text_size;
+    uint8_t reserved;
+    uint32_t line;
+    uint64_t number;
+    char name[16];
+    char text[32];
+  };
+  static_assert(sizeof(Record) == 64);
+
+  // Layout of the start of a trace file; the records follow, oldest first.
+  struct FileHeader {
+    char magic[8];          // "SSTRACE1"
+    uint32_t record_size;   // sizeof(Record)
+    uint32_t reserved;
+    uint64_t total;         // Events recorded, including any overwritten
+    uint64_t stored;        // Records in this file
+  };
+  constexpr char MAGIC[8] = { 'S','S','T','R','A','C','E','1' };
+
+  class Ring {
+  private:
+    std::string path;
+    std::vector<Record> records;
+    uint64_t total = 0;
+
+  public:
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;   // 4 MB of records
+
+    bool Active() const { return !records.empty(); }
+
+    void Start(std::string in_path, size_t capacity = DEFAULT_CAPACITY) {
+      path = std::move(in_path);
+      records.assign(capacity, Record{});
+      total = 0;
+    }
+
+    void Add(Kind kind, size_t line, uint64_t number, std::string_view name, std::string_view text) {
+      Record & rec = records[total++ % records.size()];
+      rec.kind = kind;
+      rec.line = static_cast<uint32_t>(line);
+      rec.number = number;
+      rec.name_size = static_cast<uint8_t>(std::min(name.size(), sizeof(rec.name)));
+      rec.text_size = static_cast<uint8_t>(std::min(text.size(), sizeof(rec.text)));
+      std::memcpy(rec.name, name.data(), rec.name_size);
+      std::memcpy(rec.text, text.data(), rec.text_size);
+    }
+
+    // Write the buffer, oldest record first.  Returns false on I/O failure.
+    bool Write() const {
+      if (!Active()) return true;
+      std::ofstream out(path, std::ios::binary);
+      const uint64_t stored = std::min<uint64_t>(total, records.size());
+      FileHeader header{};
+      std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+      header.record_size = sizeof(Record);
+      header.total = total;
+      header.stored = stored;
+      out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      for (uint64_t i = total - stored; i < total; ++i) {
+        out.write(reinterpret_cast<const char *>(&records[i % records.size()]), sizeof(Record));
+      }
+      return static_cast<bool>(out);
+    }
+  };
+
+  inline Ring & GetRing() {
+    static Ring ring;
+    return ring;
+  }
+
+  // === Hooks called by the interpreter ===
+
+  inline void Statement(size_t line, std::string_view word) {
+    if constexpr (enabled) {
+      if (GetRing().Active()) GetRing().Add(Kind::Statement, line, 0, word, {});
+    }
+  }
+
+  inline void Read(size_t line, std::string_view name, std::string_view value) {
+    if constexpr (enabled) {
+      if (GetRing().Active()) GetRing().Add(Kind::Read, line, value.size(), name, value);
+    }
+  }
+
+  inline void Assign(size_t line, std::string_view name, std::string_view value) {
+    if constexpr (enabled) {
+      if (GetRing().Active()) GetRing().Add(Kind::Assign, line, value.size(), name, value);
+    }
+  }
+
+  inline void Branch(size_t line, std::string_view which, bool taken) {
+    if constexpr (enabled) {
+      if (GetRing().Active()) GetRing().Add(Kind::Branch, line, taken, which, {});
+    }
+  }
+
+  inline void Loop(size_t line, uint64_t iteration) {
+    if constexpr (enabled) {
+      if (GetRing().Active()) GetRing().Add(Kind::Loop, line, iteration, "WHILE", {});
+    }
+  }
+
+  inline void LoopEnd(size_t line, uint64_t iterations) {
+    if constexpr (enabled) {
+      if (GetRing().Active()) GetRing().Add(Kind::LoopEnd, line, iterations, "WHILE", {});
+    }
+  }
+}
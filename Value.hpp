@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include <sys/mman.h>
+
+#include "Parallel.hpp"
+#include "SubstringIndex.hpp"
+
+// A string value as stored in variables and on the stack.
+//
+// Short strings (up to INLINE_CAPACITY bytes) live directly inside the Value.
+// Longer strings live in a reference-counted heap block that is shared between
+// copies, so copying a Value never allocates; the block is only duplicated when
+// a shared Value is mutated (copy-on-write).  Large blocks that are searched
+// repeatedly also carry a SubstringIndex, dropped whenever the block changes.
+//
+// Blocks of MAPPED_MIN bytes or more get pages of their own from mmap(2),
+// marked for transparent huge pages.  Growing one that isn't shared moves its
+// pages with mremap(2) instead of copying them, and releasing it unmaps it,
+// so the memory goes back to the system as soon as a variable is reassigned
+// or goes out of scope (malloc may keep freed memory for reuse).
+class Value {
+public:
+  static constexpr size_t INLINE_CAPACITY = 47;
+#ifdef __linux__
+  static constexpr size_t MAPPED_MIN = 1 << 20;
+#else
+  static constexpr size_t MAPPED_MIN = SIZE_MAX;   // No mremap(2): always use the heap
+#endif
+
+private:
+  // Header for out-of-line storage; the characters follow it directly.
+  struct Block {
+    std::atomic<uint32_t> refs{1};
+    std::atomic<uint32_t> searches{0};               // Searches since the last change
+    std::atomic<SubstringIndex *> index{nullptr};    // Built lazily by SearchIndex()
+    size_t size = 0;
+    size_t capacity = 0;
+    bool mapped = false;                             // Pages from mmap(2) rather than the heap
+
+    void DropIndex() {
+      if (SubstringIndex * old = index.exchange(nullptr, std::memory_order_acq_rel)) {
+        live_bytes.fetch_sub(old->MemoryBytes(), std::memory_order_relaxed);
+        delete old;
+      }
+      searches.store(0, std::memory_order_relaxed);
+    }
+
+    char * Data() { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  // Heap bytes held by all Values (blocks plus search indexes), for
+  // --max-memory, and the most ever held at once, for --stats.
+  static inline std::atomic<size_t> live_bytes{0};
+  static inline std::atomic<size_t> peak_bytes{0};
+
+  static void AddLiveBytes(size_t bytes) {
+    const size_t now = live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peak_bytes.load(std::memory_order_relaxed);
+    while (now > peak && !peak_bytes.compare_exchange_weak(peak, now, std::memory_order_relaxed)) { }
+  }
+
+  static constexpr size_t TAG_POS = INLINE_CAPACITY;   // Last byte of raw[]
+  static constexpr unsigned char HEAP_TAG = 0xFF;      // Tag value for "raw holds a Block*"
+
+  // Inline characters, or a Block pointer in the first bytes; the final byte
+  // holds the inline length or HEAP_TAG.
+  alignas(8) unsigned char raw[INLINE_CAPACITY + 1];
+
+  // === Storage helpers ===
+
+  bool IsHeap() const { return raw[TAG_POS] == HEAP_TAG; }
+
+  Block * GetBlock() const {
+    Block * block;
+    std::memcpy(&block, raw, sizeof(block));
+    return block;
+  }
+
+  void SetBlock(Block * block) {
+    std::memcpy(raw, &block, sizeof(block));
+    raw[TAG_POS] = HEAP_TAG;
+  }
+
+  void SetInline(const char * in, size_t size) {
+    std::memcpy(raw, in, size);
+    raw[TAG_POS] = static_cast<unsigned char>(size);
+  }
+
+  // Only called once we hold the sole reference, after changing characters.
+  void SetSize(size_t size) {
+    if (IsHeap()) {
+      Block * block = GetBlock();
+      block->size = size;
+      block->DropIndex();
+    }
+    else raw[TAG_POS] = static_cast<unsigned char>(size);
+  }
+
+  // Bytes to map for a block of at least 'capacity' characters: whole pages.
+  static size_t MappedBytes(size_t capacity) {
+    constexpr size_t PAGE = 4096;
+    return (sizeof(Block) + capacity + PAGE - 1) / PAGE * PAGE;
+  }
+
+  static Block * NewBlock(size_t capacity) {
+    void * mem = nullptr;
+    bool mapped = false;
+    if (capacity >= MAPPED_MIN) {
+      const size_t bytes = MappedBytes(capacity);
+      mem = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mem == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+      ::madvise(mem, bytes, MADV_HUGEPAGE);
+#endif
+      capacity = bytes - sizeof(Block);
+      mapped = true;
+    } else {
+      mem = ::operator new(sizeof(Block) + capacity);
+    }
+    Block * block = new (mem) Block;
+    block->capacity = capacity;
+    block->mapped = mapped;
+    AddLiveBytes(sizeof(Block) + capacity);
+    return block;
+  }
+
+  static void ReleaseBlock(Block * block) {
+    if (block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      block->DropIndex();
+      const size_t bytes = sizeof(Block) + block->capacity;
+      live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+      const bool mapped = block->mapped;
+      block->~Block();
+      if (mapped) ::munmap(block, bytes);
+      else ::operator delete(block);
+    }
+  }
+
+  // Grow our mapped, unshared block to hold at least 'capacity' characters,
+  // letting the kernel move its pages rather than copying them.  False (with
+  // the block unchanged) if that isn't possible.
+  bool Remap(size_t capacity) {
+#ifdef __linux__
+    if (!IsHeap() || IsShared() || !GetBlock()->mapped) return false;
+    Block * block = GetBlock();
+    block->DropIndex();                              // It may point at the old pages.
+    const size_t old_bytes = sizeof(Block) + block->capacity, bytes = MappedBytes(capacity);
+    void * mem = ::mremap(block, old_bytes, bytes, MREMAP_MAYMOVE);
+    if (mem == MAP_FAILED) return false;
+#ifdef MADV_HUGEPAGE
+    ::madvise(mem, bytes, MADV_HUGEPAGE);
+#endif
+    block = static_cast<Block *>(mem);
+    block->capacity = bytes - sizeof(Block);
+    AddLiveBytes(bytes - old_bytes);
+    SetBlock(block);
+    return true;
+#else
+    (void) capacity;
+    return false;
+#endif
+  }
+
+  void Retain() const {
+    if (IsHeap()) GetBlock()->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void Release() {
+    if (IsHeap()) ReleaseBlock(GetBlock());
+    raw[TAG_POS] = 0;
+  }
+
+  // Can we write 'new_size' bytes into our current buffer without affecting anyone else?
+  bool HasRoom(size_t new_size) const {
+    if (!IsHeap()) return new_size <= INLINE_CAPACITY;
+    const Block * block = GetBlock();
+    return block->capacity >= new_size && block->refs.load(std::memory_order_acquire) == 1;
+  }
+
+public:
+  Value() { raw[TAG_POS] = 0; }
+  Value(std::string_view in) {
+    if (in.size() <= INLINE_CAPACITY) SetInline(in.data(), in.size());
+    else {
+      Block * block = NewBlock(in.size());
+      parallel::Copy(block->Data(), in.data(), in.size());
+      block->size = in.size();
+      SetBlock(block);
+    }
+  }
+  Value(const std::string & in) : Value(std::string_view(in)) { }
+
+  // A Value of 'size' characters, written in place by fill(char * out).
+  template <typename FUN_T>
+  static Value Filled(size_t size, FUN_T && fill) {
+    Value out;
+    out.Reserve(size);
+    fill(const_cast<char *>(out.data()));
+    out.SetSize(size);
+    return out;
+  }
+  Value(const char * in) : Value(std::string_view(in)) { }
+
+  Value(const Value & in) {
+    in.Retain();
+    std::memcpy(raw, in.raw, sizeof(raw));
+  }
+  Value(Value && in) noexcept {
+    std::memcpy(raw, in.raw, sizeof(raw));
+    in.raw[TAG_POS] = 0;
+  }
+  ~Value() { Release(); }
+
+  Value & operator=(const Value & in) {
+    in.Retain();           // Retain first so self-assignment is safe.
+    Release();
+    std::memcpy(raw, in.raw, sizeof(raw));
+    return *this;
+  }
+  Value & operator=(Value && in) noexcept {
+    if (this != &in) {
+      Release();
+      std::memcpy(raw, in.raw, sizeof(raw));
+      in.raw[TAG_POS] = 0;
+    }
+    return *this;
+  }
+
+  // === Access ===
+
+  size_t size() const { return IsHeap() ? GetBlock()->size : raw[TAG_POS]; }
+  bool empty() const { return size() == 0; }
+  const char * data() const {
+    return IsHeap() ? GetBlock()->Data() : reinterpret_cast<const char *>(raw);
+  }
+  std::string_view view() const { return std::string_view(data(), size()); }
+  operator std::string_view() const { return view(); }
+  std::string str() const { return std::string(view()); }
+
+  // Heap bytes currently held by all Values together.
+  static size_t LiveBytes() { return live_bytes.load(std::memory_order_relaxed); }
+  static size_t PeakBytes() { return peak_bytes.load(std::memory_order_relaxed); }
+
+  // Is our heap block also referenced by another Value?
+  bool IsShared() const {
+    return IsHeap() && GetBlock()->refs.load(std::memory_order_acquire) != 1;
+  }
+
+  // Are these two Values sharing the same heap block?
+  bool SharesWith(const Value & in) const {
+    return IsHeap() && in.IsHeap() && GetBlock() == in.GetBlock();
+  }
+
+  // Index for searching this Value, or nullptr while it is too small or too
+  // rarely searched to be worth building one.  Each call counts as a search.
+  const SubstringIndex * SearchIndex() const {
+    if (!IsHeap()) return nullptr;
+    Block * block = GetBlock();
+    if (block->size < SubstringIndex::MIN_SIZE || block->size > SubstringIndex::MAX_SIZE) return nullptr;
+    if (SubstringIndex * index = block->index.load(std::memory_order_acquire)) return index;
+    if (block->searches.fetch_add(1, std::memory_order_relaxed) + 1 < SubstringIndex::MIN_SEARCHES) {
+      return nullptr;
+    }
+    SubstringIndex * fresh = new SubstringIndex(view());
+    SubstringIndex * expected = nullptr;
+    if (!block->index.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)) {
+      delete fresh;        // Another thread built one first.
+      return expected;
+    }
+    AddLiveBytes(fresh->MemoryBytes());
+    return fresh;
+  }
+
+  // === Mutation (copy-on-write) ===
+
+  // Add characters to the end, growing geometrically when out of room.
+  // 'piece' may point into this Value.
+  void Append(std::string_view piece) {
+    const size_t old_size = size();
+    const size_t new_size = old_size + piece.size();
+    if (HasRoom(new_size)) {
+      char * out = const_cast<char *>(data());
+      parallel::Copy(out + old_size, piece.data(), piece.size());
+      SetSize(new_size);
+      return;
+    }
+    const size_t capacity = std::max(new_size, old_size * 2);
+    const char * old_data = data();
+    const bool inside = piece.data() >= old_data && piece.data() < old_data + old_size;
+    if (Remap(capacity)) {
+      char * out = const_cast<char *>(data());
+      if (inside) piece = { out + (piece.data() - old_data), piece.size() };
+      parallel::Copy(out + old_size, piece.data(), piece.size());
+      SetSize(new_size);
+      return;
+    }
+    Block * block = NewBlock(capacity);
+    parallel::Copy(block->Data(), data(), old_size);
+    parallel::Copy(block->Data() + old_size, piece.data(), piece.size());
+    block->size = new_size;
+    Release();
+    SetBlock(block);
+  }
+
+  // Remove 'count' characters starting at 'pos'.
+  void Erase(size_t pos, size_t count) {
+    const size_t old_size = size();
+    if (pos >= old_size || count == 0) return;
+    count = std::min(count, old_size - pos);
+    if (IsShared()) {       // Build the result directly rather than copy, then shift.
+      const std::string_view in = view();
+      Value out;
+      out.Reserve(old_size - count);
+      out.Append(in.substr(0, pos));
+      out.Append(in.substr(pos + count));
+      *this = std::move(out);
+      return;
+    }
+    char * out = const_cast<char *>(data());
+    std::memmove(out + pos, out + pos + count, old_size - pos - count);
+    SetSize(old_size - count);
+  }
+
+  // Keep only the first 'count' characters.
+  void Truncate(size_t count) {
+    if (count >= size()) return;
+    if (IsShared()) {
+      *this = Value(view().substr(0, count));
+      return;
+    }
+    SetSize(count);
+  }
+
+  // Drop the first 'count' characters.
+  void RemovePrefix(size_t count) {
+    if (count >= size()) Clear();
+    else if (IsShared()) *this = Value(view().substr(count));
+    else Erase(0, count);
+  }
+
+  // Make room for at least 'capacity' characters without changing the contents.
+  void Reserve(size_t capacity) {
+    if (HasRoom(capacity) || Remap(capacity)) return;
+    const size_t old_size = size();
+    Block * block = NewBlock(std::max(capacity, old_size));
+    parallel::Copy(block->Data(), data(), old_size);
+    block->size = old_size;
+    Release();
+    SetBlock(block);
+  }
+
+  void Clear() { *this = Value(); }
+};
+
+inline std::ostream & operator<<(std::ostream & os, const Value & value) {
+  return os << value.view();
+}
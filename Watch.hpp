@@ -0,0 +1,70 @@
+#pragma once
+
+// Waiting for a source file to change (--watch).
+//
+// The file's directory is watched rather than the file itself: many editors
+// save by writing a new file and renaming it over the old one, which would
+// silently end a watch on the original inode.
+
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+class FileWatcher {
+private:
+  int fd = -1;
+  std::string dir;
+  std::string name;       // File name within 'dir'
+
+  static constexpr uint32_t EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+  static constexpr int SETTLE_MS = 30;   // Quiet time that ends a burst of events
+
+  // Read the pending events; true if any of them is about our file.
+  bool Drain() {
+    alignas(inotify_event) char buffer[16 * 1024];
+    bool changed = false;
+    const ssize_t got = ::read(fd, buffer, sizeof(buffer));
+    for (ssize_t pos = 0; pos < got; ) {
+      const auto * event = reinterpret_cast<const inotify_event *>(buffer + pos);
+      if (event->len > 0 && name == event->name) changed = true;
+      pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+    }
+    return changed;
+  }
+
+public:
+  explicit FileWatcher(std::string_view path) {
+    const size_t slash = path.rfind('/');
+    dir = (slash == std::string_view::npos) ? "." : std::string(path.substr(0, slash + 1));
+    name = path.substr(slash == std::string_view::npos ? 0 : slash + 1);
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, dir.c_str(), EVENTS) < 0) { ::close(fd); fd = -1; }
+  }
+  ~FileWatcher() { if (fd >= 0) ::close(fd); }
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher & operator=(const FileWatcher &) = delete;
+
+  bool Ok() const { return fd >= 0; }
+
+  // Block until the file has been saved again, then wait for the save to
+  // settle (editors often write several times).  'changed_at' is set to
+  // when the first event arrived; returns false if watching failed.
+  bool Wait(std::chrono::steady_clock::time_point & changed_at) {
+    pollfd pfd{ fd, POLLIN, 0 };
+    while (true) {
+      if (::poll(&pfd, 1, -1) < 0) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      if (Drain()) break;
+    }
+    changed_at = std::chrono::steady_clock::now();
+    while (::poll(&pfd, 1, SETTLE_MS) > 0) Drain();
+    return true;
+  }
+};
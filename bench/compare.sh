@@ -0,0 +1,32 @@
+#!/usr/bin/env bash
+# Diff two saved benchmark runs.  Run from the bench/ directory.
+#   ./compare.sh BASE NEW     (labels or paths of files in results/)
+# Each cell is NEW / BASE for that workload and metric; "-" means the metric
+# is missing from either run.
+
+resolve() {
+  if [[ -f "$1" ]]; then echo "$1"; else echo "results/$1.tsv"; fi
+}
+BASE=$(resolve "$1")
+NEW=$(resolve "$2")
+
+if [[ $# -ne 2 || ! -f "$BASE" || ! -f "$NEW" ]]; then
+  echo "Format: $0 BASE NEW   (saved by run_bench.sh in results/)"
+  exit 1
+fi
+
+awk -F'\t' -v OFS='\t' '
+  FNR == 1 { header = $0; next }
+  NR == FNR { base[$1] = $0; next }
+  ($1 in base) {
+    split(base[$1], b, "\t")
+    line = $1
+    for (i = 2; i <= NF; i++) {
+      if ($i == "-" || b[i] == "-" || b[i] == 0) line = line OFS "-"
+      else line = line OFS sprintf("%.3fx", $i / b[i])
+    }
+    rows = rows line "\n"
+  }
+  END { printf "%s\n%s", header, rows }
+' "$BASE" "$NEW" |
+  awk -F'\t' '{ printf "%-14s", $1; for (i = 2; i <= NF; i++) printf " %14s", $i; print "" }'
@@ -0,0 +1,203 @@
+#!/usr/bin/env bash
+# Generate benchmark programs into the given directory (default: workloads/).
+# Workloads are generated rather than committed because several are large.
+
+OUT_DIR="${1:-workloads}"
+mkdir -p "$OUT_DIR"
+
+# repeat STRING COUNT -- print STRING COUNT times with no separator.
+repeat() {
+  local out="" i
+  for ((i = 0; i < $2; i++)); do out+="$1"; done
+  printf '%s' "$out"
+}
+
+# loop_heavy: a long WHILE loop that reads variables in its condition, in
+# assignments and in PRINTs every iteration.
+{
+  echo "VAR count = \"$(repeat a 20000)\""
+  echo "VAR label = \"a label that is longer than sixteen characters\""
+  echo "VAR seen = \"\""
+  echo "WHILE (count) {"
+  echo "  seen = label"
+  echo "  PRINT label"
+  echo "  count = count - \"a\""
+  echo "}"
+  echo "PRINT seen"
+} > "$OUT_DIR/loop_heavy.sstack"
+
+# search_heavy: one ~1 MB log-like value probed with many different needles
+# inside a WHILE loop, so the same haystack is searched over and over.
+{
+  printf 'VAR log = "'
+  awk 'BEGIN { lv[0]="INFO"; lv[1]="WARN"; lv[2]="DEBUG"; lv[3]="ERROR";
+               for (i = 0; i < 16000; i++)
+                 printf "2024-05-%02d [%s] worker-%d processed request id=%d status=ok ",
+                        10 + i % 20, lv[i % 4], i % 16, (i * 7919) % 100000 }'
+  echo '"'
+  echo "VAR count = \"$(repeat a 2000)\""
+  echo "VAR probe = \"\""
+  echo "WHILE (count) {"
+  echo "  probe = log / \"worker-99 processed\""
+  echo "  probe = log / \"status=failed\""
+  echo "  probe = log % \"id=100001\""
+  echo "  count = count - \"a\""
+  echo "}"
+  echo "PRINT count"
+} > "$OUT_DIR/search_heavy.sstack"
+
+# deep_nesting: 50000 nested IF blocks and an expression inside 50000
+# parentheses (used to overflow the C++ stack before execution was iterative).
+{
+  echo "VAR deep = \"\""
+  for ((i = 0; i < 50000; i++)); do echo "IF (\"1\") {"; done
+  echo "deep = $(repeat '(' 50000)\"deep\"$(repeat ' + "er")' 50000)"
+  for ((i = 0; i < 50000; i++)); do echo "}"; done
+  echo "PRINT deep"
+} > "$OUT_DIR/deep_nesting.sstack"
+
+# shallow_mix: many short statements at the top level and in a WHILE body,
+# where statement dispatch rather than string work dominates.
+{
+  echo "VAR a = \"alpha\""
+  echo "VAR b = \"beta\""
+  echo "VAR c = \"\""
+  for ((i = 0; i < 5000; i++)); do
+    echo "c = a + b - \"ph\""
+    echo "IF (c ? \"lab\") PRINT c"
+    echo "ELSE PRINT \"no\""
+    echo "{"
+    echo "  VAR d = a + \"x\""
+    echo "  d = d + b / \"t\""
+    echo "  PRINT d"
+    echo "}"
+  done
+  echo "VAR count = \"$(repeat a 3000)\""
+  echo "WHILE (count) {"
+  echo "  c = a + b"
+  echo "  c = c - \"ph\""
+  echo "  c = (c + a) % \"l\""
+  echo "  PRINT c"
+  echo "  b = b + \"\""
+  echo "  count = count - \"a\""
+  echo "}"
+} > "$OUT_DIR/shallow_mix.sstack"
+
+# accumulate: the common "out = out + piece" pattern, growing one variable to
+# about 1 MB, then trimming it from the front and back.
+{
+  echo "VAR out = \"\""
+  echo "VAR piece = \"$(repeat 'line of output, ' 8)\""
+  echo "VAR count = \"$(repeat a 8000)\""
+  echo "WHILE (count) {"
+  echo "  out = out + piece + \"|\""
+  echo "  count = count % \"a\""
+  echo "}"
+  echo "VAR trim = \"$(repeat a 2000)\""
+  echo "WHILE (trim) {"
+  echo "  out = out % \"|\""
+  echo "  out = out - \"line of output, \""
+  echo "  trim = trim % \"a\""
+  echo "}"
+  echo "out = out / \"|\""
+  echo "PRINT out"
+} > "$OUT_DIR/accumulate.sstack"
+
+# tight_loop: four nested WHILE loops of 40 iterations around a one-line body,
+# so about 2.5 million backedges with almost no work between them.
+{
+  A="$(repeat a 40)"
+  echo "VAR h = \"$A\""
+  echo "VAR i = \"\""
+  echo "VAR j = \"\""
+  echo "VAR k = \"\""
+  echo "VAR x = \"\""
+  echo "WHILE (h) {"
+  echo "  i = \"$A\""
+  echo "  WHILE (i) {"
+  echo "    j = \"$A\""
+  echo "    WHILE (j) {"
+  echo "      k = \"$A\""
+  echo "      WHILE (k) {"
+  echo "        x = \"b\""
+  echo "        k = k - \"a\""
+  echo "      }"
+  echo "      j = j - \"a\""
+  echo "    }"
+  echo "    i = i - \"a\""
+  echo "  }"
+  echo "  h = h - \"a\""
+  echo "}"
+  echo "PRINT x"
+} > "$OUT_DIR/tight_loop.sstack"
+
+# repeated_expr: straight-line code that repeats the same searches over a
+# mid-sized value (too small to be indexed), as in "x = s / sep" right after
+# "PRINT (s / sep)".
+{
+  printf 'VAR log = "'
+  awk 'BEGIN { for (i = 0; i < 1200; i++)
+                 printf "worker-%d processed id=%d status=ok ", i % 16, (i * 7919) % 100000 }'
+  echo '"'
+  echo "VAR count = \"$(repeat a 20000)\""
+  echo "VAR head = \"\""
+  echo "VAR tail = \"\""
+  echo "WHILE (count) {"
+  echo "  head = log / \"status=failed\""
+  echo "  tail = log % \"status=failed\""
+  echo "  head = log / \"status=failed\" - \"worker-0 \""
+  echo "  tail = (log % \"status=failed\") % \"worker-1 \""
+  echo "  count = count - \"a\""
+  echo "}"
+  echo "PRINT tail"
+} > "$OUT_DIR/repeated_expr.sstack"
+
+# independent_groups: a long run of top-level statement groups that share
+# only a read-only value, each doing a few large copies and searches (the
+# kind of code --jobs can spread over threads).
+{
+  printf 'VAR base = "'
+  awk 'BEGIN { for (i = 0; i < 6000; i++) printf "entry %d of the shared base text; ", i }'
+  echo '"'
+  for ((i = 0; i < 400; i++)); do
+    echo "VAR g$i = base + \"tail $i\""
+    echo "g$i = g$i - \"entry $((i * 13 % 6000)) \""
+    echo "PRINT g$i % \"entry 59\" / \";\""
+  done
+} > "$OUT_DIR/independent_groups.sstack"
+
+# skip_heavy: a large source file (about 1 MB) that is mostly a block
+# skipped on every WHILE iteration, so lexing and scanning for the matching
+# '}' dominate.
+{
+  echo "VAR count = \"$(repeat a 300)\""
+  echo "VAR x = \"\""
+  echo "WHILE (count) {"
+  echo "  IF (count == \"never\") {"
+  for ((i = 0; i < 10000; i++)); do
+    echo "    x = x + \"some text\" - \"me\""
+    echo "    IF (x ? \"t\") { PRINT x }"
+    echo "    ELSE { x = (x + \"y\") / \"z\" }"
+  done
+  echo "  }"
+  echo "  count = count - \"a\""
+  echo "}"
+  echo "PRINT count"
+} > "$OUT_DIR/skip_heavy.sstack"
+
+# print_heavy: nested loops that PRINT about 80 MB of short and medium
+# lines, so the time goes into producing output (see output_cost.sh).
+{
+  echo "VAR line = \"$(repeat 'output line ' 12)\""
+  echo "VAR outer = \"$(repeat a 400)\""
+  echo "VAR inner = \"\""
+  echo "WHILE (outer) {"
+  echo "  inner = \"$(repeat a 500)\""
+  echo "  WHILE (inner) {"
+  echo "    PRINT line"
+  echo "    PRINT inner"
+  echo "    inner = inner - \"a\""
+  echo "  }"
+  echo "  outer = outer - \"a\""
+  echo "}"
+} > "$OUT_DIR/print_heavy.sstack"
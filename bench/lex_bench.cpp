@@ -0,0 +1,64 @@
+// Microbenchmark for Lexer::Tokenize with and without the line memo.
+// Build and run with "make lex_bench".
+//
+// Each input is about 8 MB of script.  They range from generator output
+// that repeats a handful of lines to text where no line repeats at all,
+// which shows what the memo costs when it never hits.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../lexer.hpp"
+
+static constexpr size_t INPUT_SIZE = 8 << 20;
+
+// Lines drawn in turn from 'distinct' variants of a few statement shapes.
+static std::string MakeScript(size_t distinct) {
+  const char * shapes[] = {
+    "  out = out + sep",
+    "  IF (out ? \"marker\") { PRINT out % \"marker\" }",
+    "  count = count - \"a\"  // one fewer",
+    "VAR name = \"some literal text\" + suffix",
+  };
+  std::string out;
+  for (size_t line = 0; out.size() < INPUT_SIZE; ++line) {
+    out += shapes[line % 4];
+    if (distinct > 4) out += " + v" + std::to_string(line % distinct);
+    out += '\n';
+  }
+  return out;
+}
+
+static double TimeTokenize(const std::string & text, bool memo, size_t & tokens) {
+  double best = 1e30;
+  for (int rep = 0; rep < 5; ++rep) {
+    emplex::Lexer lexer;
+    lexer.SetLineMemo(memo);
+    const auto start = std::chrono::steady_clock::now();
+    tokens = lexer.Tokenize(text);
+    const auto end = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+int main() {
+  struct Input { const char * name; size_t distinct; };
+  const std::vector<Input> inputs = {
+    { "4 lines", 4 }, { "64 lines", 64 }, { "4096 lines", 4096 }, { "all unique", SIZE_MAX },
+  };
+  std::printf("%-12s %10s %12s %12s %8s\n", "input", "tokens", "plain(ms)", "memo(ms)", "speedup");
+  for (const Input & input : inputs) {
+    const std::string text = MakeScript(input.distinct);
+    size_t plain_tokens = 0, memo_tokens = 0;
+    const double plain = TimeTokenize(text, false, plain_tokens);
+    const double memo = TimeTokenize(text, true, memo_tokens);
+    if (plain_tokens != memo_tokens) {
+      std::printf("MISMATCH on %s: %zu vs %zu tokens\n", input.name, plain_tokens, memo_tokens);
+      return 1;
+    }
+    std::printf("%-12s %10zu %12.2f %12.2f %7.2fx\n", input.name, memo_tokens, plain, memo, plain / memo);
+  }
+}
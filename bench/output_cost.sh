@@ -0,0 +1,46 @@
+#!/usr/bin/env bash
+# Compare synchronous PRINT output with --async-output.  Run from bench/.
+# Each PRINT-heavy workload is timed with stdout going to /dev/null, to a
+# file, to a pipe that discards it, and to a pipe into a slow consumer
+# (gzip), where a background writer has the most to hide.
+
+BIN="${1:-../Project2}"
+WORK_DIR="workloads"
+ROUNDS=3
+
+if [[ ! -x "$BIN" ]]; then
+  echo "Missing executable: $BIN"
+  exit 1
+fi
+
+./gen_workloads.sh "$WORK_DIR"
+out_file=$(mktemp)
+trap 'rm -f "$out_file"' EXIT
+
+# best SINK ARGS... -- fastest wall time of ROUNDS runs writing to SINK
+best() {
+  local sink=$1 start end ns best_ns=""
+  shift
+  for ((r = 0; r < ROUNDS; r++)); do
+    start=$(date +%s%N)
+    case "$sink" in
+      null) "$BIN" "$@" >/dev/null ;;
+      file) "$BIN" "$@" >"$out_file" ;;
+      pipe) "$BIN" "$@" | cat >/dev/null ;;
+      gzip) "$BIN" "$@" | gzip -1 >/dev/null ;;
+    esac
+    end=$(date +%s%N)
+    ns=$((end - start))
+    if [[ -z "$best_ns" ]] || (( ns < best_ns )); then best_ns=$ns; fi
+  done
+  awk -v ns="$best_ns" 'BEGIN { printf "%.3f", ns / 1e9 }'
+}
+
+printf '%-14s %-6s %10s %14s\n' "workload" "sink" "default" "--async-output"
+for name in print_heavy loop_heavy; do
+  prog="$WORK_DIR/$name.sstack"
+  for sink in null file pipe gzip; do
+    printf '%-14s %-6s %10s %14s\n' "$name" "$sink" \
+      "$(best "$sink" "$prog")" "$(best "$sink" --async-output "$prog")"
+  done
+done
@@ -0,0 +1,156 @@
+// Run one command and report hardware performance counters for it.
+// Build with "make bench/perf_run"; used by run_bench.sh.
+//
+//   perf_run [-r RUNS] [--header] COMMAND [ARGS...]
+//
+// Prints one tab-separated line: cycles, instructions, cache misses, branch
+// misses, minor page faults, wall seconds and CPU seconds, each the median
+// over RUNS runs (default 3).  Counters come from perf_event_open; any that
+// cannot be opened (common in containers and VMs) are printed as "-", so the
+// times and page faults are always available.  The command's stdout is
+// discarded.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+  struct Counter {
+    const char * name;
+    uint64_t config;    // PERF_COUNT_HW_*
+  };
+
+  constexpr std::array<Counter, 4> COUNTERS = {{
+    { "cycles",        PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",  PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache_misses",  PERF_COUNT_HW_CACHE_MISSES },
+    { "branch_misses", PERF_COUNT_HW_BRANCH_MISSES },
+  }};
+
+  constexpr double UNAVAILABLE = -1.0;
+
+  // Results of one run: the counters (UNAVAILABLE if not opened), then
+  // page faults, wall seconds and CPU seconds.
+  using Sample = std::array<double, COUNTERS.size() + 3>;
+
+  // Open a counter for 'pid' that starts when it calls exec.  Returns -1 if
+  // the kernel (or the container) won't allow it.
+  int OpenCounter(pid_t pid, uint64_t config) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+  }
+
+  // Counter value, scaled up if the kernel had to multiplex it.
+  double ReadCounter(int fd) {
+    uint64_t values[3] = {};   // value, time enabled, time running
+    if (read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) return UNAVAILABLE;
+    return static_cast<double>(values[0]) * static_cast<double>(values[1]) / static_cast<double>(values[2]);
+  }
+
+  bool RunOnce(char ** command, Sample & sample) {
+    // The child waits for the counters to be attached before it execs.
+    int go[2];
+    if (pipe(go) != 0) return false;
+
+    const pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+      close(go[1]);
+      char byte;
+      if (read(go[0], &byte, 1) < 0) _exit(127);
+      close(go[0]);
+      const int null_fd = open("/dev/null", O_WRONLY);
+      if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+      execvp(command[0], command);
+      std::perror(command[0]);
+      _exit(127);
+    }
+
+    close(go[0]);
+    std::array<int, COUNTERS.size()> fds;
+    for (size_t i = 0; i < COUNTERS.size(); ++i) fds[i] = OpenCounter(pid, COUNTERS[i].config);
+
+    const auto start = std::chrono::steady_clock::now();
+    close(go[1]);
+    int status = 0;
+    rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    const auto end = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < COUNTERS.size(); ++i) {
+      sample[i] = (fds[i] >= 0) ? ReadCounter(fds[i]) : UNAVAILABLE;
+      if (fds[i] >= 0) close(fds[i]);
+    }
+    auto seconds = [](const timeval & tv) { return static_cast<double>(tv.tv_sec) + static_cast<double>(tv.tv_usec) / 1e6; };
+    sample[COUNTERS.size()] = static_cast<double>(usage.ru_minflt);
+    sample[COUNTERS.size() + 1] = std::chrono::duration<double>(end - start).count();
+    sample[COUNTERS.size() + 2] = seconds(usage.ru_utime) + seconds(usage.ru_stime);
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) return false;   // Could not exec.
+    return true;
+  }
+
+  void PrintHeader() {
+    for (const Counter & counter : COUNTERS) std::printf("%s\t", counter.name);
+    std::printf("page_faults\twall_s\tcpu_s\n");
+  }
+}
+
+int main(int argc, char * argv[]) {
+  int runs = 3;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    const std::string_view option = argv[arg];
+    if (option == "--header") { PrintHeader(); return 0; }
+    else if (option == "-r" && arg + 1 < argc) runs = std::max(1, std::atoi(argv[++arg]));
+    else break;
+  }
+  if (arg >= argc) {
+    std::fprintf(stderr, "Format: %s [-r RUNS] [--header] COMMAND [ARGS...]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<Sample> samples(static_cast<size_t>(runs));
+  for (Sample & sample : samples) {
+    if (!RunOnce(argv + arg, sample)) {
+      std::fprintf(stderr, "ERROR: unable to run '%s'\n", argv[arg]);
+      return 1;
+    }
+  }
+
+  // Report the median of each column separately.
+  for (size_t col = 0; col < Sample{}.size(); ++col) {
+    std::vector<double> column;
+    for (const Sample & sample : samples) column.push_back(sample[col]);
+    std::sort(column.begin(), column.end());
+    const double median = column[column.size() / 2];
+    const char * sep = (col + 1 < Sample{}.size()) ? "\t" : "\n";
+    if (median == UNAVAILABLE) std::printf("-%s", sep);
+    else if (col < COUNTERS.size() + 1) std::printf("%.0f%s", median, sep);
+    else std::printf("%.4f%s", median, sep);
+  }
+  return 0;
+}
@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+# Compare the default build against the PGO+LTO build.  Run from bench/.
+# Each time is the best of several runs to keep noise down.
+
+DEFAULT="../Project2"
+PGO="../Project2-pgo"
+WORK_DIR="workloads"
+RUNS=5
+
+for bin in "$DEFAULT" "$PGO"; do
+  if [[ ! -x "$bin" ]]; then
+    echo "Missing executable: $bin"
+    exit 1
+  fi
+done
+
+./gen_workloads.sh "$WORK_DIR"
+
+# best BINARY PROG -- fastest wall time of RUNS runs, in nanoseconds
+best() {
+  local start end t min=""
+  for ((i = 0; i < RUNS; i++)); do
+    start=$(date +%s%N)
+    "$1" "$2" >/dev/null
+    end=$(date +%s%N)
+    t=$((end - start))
+    if [[ -z "$min" ]] || (( t < min )); then min=$t; fi
+  done
+  echo "$min"
+}
+
+printf '%-20s %10s %10s %9s\n' "workload" "default" "pgo" "speedup"
+for prog in "$WORK_DIR"/*.sstack; do
+  name="${prog##*/}"
+  base=$(best "$DEFAULT" "$prog")
+  pgo=$(best "$PGO" "$prog")
+  awk -v n="${name%.sstack}" -v b="$base" -v p="$pgo" \
+    'BEGIN { printf "%-20s %10.3f %10.3f %8.2fx\n", n, b / 1e9, p / 1e9, b / p }'
+done
+echo "(Times are seconds, best of $RUNS.  The workloads are also part of the"
+echo " training corpus, so they show the best case for the profile.)"
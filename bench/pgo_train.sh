@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+# Run an instrumented build over the PGO training corpus.  Run from bench/.
+#   ./pgo_train.sh BINARY
+# The corpus is every generated workload (loop-, concat-, search- and
+# lex-heavy programs) plus the programs in tests/ and my_tests/.  Exit
+# statuses are ignored: error paths are worth profiling too.
+
+BIN="$1"
+WORK_DIR="workloads"
+
+if [[ ! -x "$BIN" ]]; then
+  echo "Missing executable: $BIN"
+  exit 1
+fi
+
+./gen_workloads.sh "$WORK_DIR"
+
+count=0
+for prog in "$WORK_DIR"/*.sstack ../tests/*.sstack ../my_tests/*.sstack; do
+  "$BIN" "$prog" >/dev/null 2>&1
+  ((count++))
+done
+echo "Trained on $count programs."
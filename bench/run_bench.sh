@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+# Measure each benchmark workload.  Run from the bench/ directory.
+#   ./run_bench.sh [binary] [label]     (default binary: ../Project2)
+# Hardware counters (cycles, instructions, cache and branch misses) are
+# collected by perf_run when the kernel allows it; otherwise those columns
+# show "-" and only page faults, wall and CPU time are reported.  Results are
+# also saved to results/LABEL.tsv (default label: the current git commit) so
+# two builds can be diffed with compare.sh.
+
+BIN="${1:-../Project2}"
+LABEL="${2:-$(git rev-parse --short HEAD 2>/dev/null || date +%Y%m%d-%H%M%S)}"
+WORK_DIR="workloads"
+RESULTS_DIR="results"
+PERF_RUN="./perf_run"
+
+for exe in "$BIN" "$PERF_RUN"; do
+  if [[ ! -x "$exe" ]]; then
+    echo "Missing executable: $exe"
+    exit 1
+  fi
+done
+
+./gen_workloads.sh "$WORK_DIR"
+mkdir -p "$RESULTS_DIR"
+out="$RESULTS_DIR/$LABEL.tsv"
+
+{
+  printf 'workload\t'
+  "$PERF_RUN" --header
+  for prog in "$WORK_DIR"/*.sstack; do
+    name="${prog##*/}"
+    printf '%s\t' "${name%.sstack}"
+    "$PERF_RUN" -r 3 "$BIN" "$prog"
+  done
+} > "$out"
+
+awk -F'\t' '{ printf "%-14s", $1; for (i = 2; i <= NF; i++) printf " %14s", $i; print "" }' "$out"
+echo "Saved to bench/$out"
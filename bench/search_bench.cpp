@@ -0,0 +1,73 @@
+// Microbenchmark for Search.hpp across needle and haystack sizes.
+// Build and run with "make search_bench".
+//
+// Haystacks are log-like text; each needle is a slice of the haystack taken
+// near the end (so most of the haystack is scanned) with its last byte
+// changed, which makes it absent but produces plenty of partial matches.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../Search.hpp"
+
+static std::string MakeLog(size_t size) {
+  std::string out;
+  const char * levels[] = { "INFO", "WARN", "DEBUG", "ERROR" };
+  for (size_t line = 0; out.size() < size; ++line) {
+    out += "2024-05-";
+    out += std::to_string(10 + line % 20);
+    out += " 12:";
+    out += std::to_string(10 + line % 50);
+    out += " [";
+    out += levels[line % 4];
+    out += "] worker-" + std::to_string(line % 16) + " processed request id=";
+    out += std::to_string(line * 7919 % 100000);
+    out += " status=ok\n";
+  }
+  out.resize(size);
+  return out;
+}
+
+template <typename FUN>
+static double TimeIt(size_t reps, FUN && fun) {
+  size_t sink = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < reps; ++i) sink += fun();
+  const auto end = std::chrono::steady_clock::now();
+  if (sink == 42) std::puts("");   // Keep the calls from being optimized away.
+  return std::chrono::duration<double, std::micro>(end - start).count() / static_cast<double>(reps);
+}
+
+int main() {
+  const std::vector<size_t> hay_sizes = { 1 << 10, 1 << 16, 1 << 22 };
+  const std::vector<size_t> needle_sizes = { 1, 4, 16, 64, 256, 1024 };
+
+  std::printf("%10s %8s %14s %14s %14s\n", "haystack", "needle",
+              "std::find(us)", "Find(us)", "cached(us)");
+  for (size_t hay_size : hay_sizes) {
+    const std::string hay = MakeLog(hay_size);
+    const size_t reps = std::max<size_t>(4, (1u << 24) / hay_size);
+    for (size_t needle_size : needle_sizes) {
+      if (needle_size * 4 > hay_size) continue;
+      std::string needle = hay.substr(hay_size - needle_size * 3, needle_size);
+      needle.back() = '#';
+
+      const size_t expected = std::string_view(hay).find(needle);
+      search::NeedleCache cache;
+      if (search::Find(hay, needle) != expected || cache.Find(hay, needle) != expected) {
+        std::printf("MISMATCH: haystack %zu needle %zu\n", hay_size, needle_size);
+        return 1;
+      }
+
+      const double t_std = TimeIt(reps, [&]{ return std::string_view(hay).find(needle); });
+      const double t_find = TimeIt(reps, [&]{ return search::Find(hay, needle); });
+      const double t_cache = TimeIt(reps, [&]{ return cache.Find(hay, needle); });
+      std::printf("%10zu %8zu %14.2f %14.2f %14.2f\n",
+                  hay_size, needle_size, t_std, t_find, t_cache);
+    }
+  }
+  return 0;
+}
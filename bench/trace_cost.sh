@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+# Show that tracing costs nothing unless it is compiled in.  Run from bench/.
+#  1. The default binary must contain no trace symbols at all.
+#  2. Each workload is timed with the default binary, the trace build without
+#     --trace, and the trace build with --trace.
+
+DEFAULT="../Project2"
+TRACED="../Project2-trace"
+WORK_DIR="workloads"
+
+for bin in "$DEFAULT" "$TRACED"; do
+  if [[ ! -x "$bin" ]]; then
+    echo "Missing executable: $bin"
+    exit 1
+  fi
+done
+
+symbols=$(nm -C "$DEFAULT" | grep -c 'trace::')
+echo "trace symbols in $DEFAULT: $symbols"
+if (( symbols != 0 )); then
+  echo "FAILED: default build contains tracing code"
+  exit 1
+fi
+
+./gen_workloads.sh "$WORK_DIR"
+
+# seconds BINARY ARGS... -- wall time of one run
+seconds() {
+  local start end
+  start=$(date +%s%N)
+  "$@" >/dev/null
+  end=$(date +%s%N)
+  awk -v ns=$((end - start)) 'BEGIN { printf "%.3f", ns / 1e9 }'
+}
+
+trace_file=$(mktemp)
+printf '%-20s %10s %14s %14s\n' "workload" "default" "trace-build" "--trace"
+for prog in "$WORK_DIR"/*.sstack; do
+  name="${prog##*/}"
+  printf '%-20s %10s %14s %14s\n' "${name%.sstack}" \
+    "$(seconds "$DEFAULT" "$prog")" \
+    "$(seconds "$TRACED" "$prog")" \
+    "$(seconds "$TRACED" --trace "$trace_file" "$prog")"
+done
+rm -f "$trace_file"
@@ -1,16 +1,55 @@
 #pragma once
 
+#include <charconv>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
+
+#include "Diagnostic.hpp"
 
 // Various helper functions can go here.
 
 template <typename... Ts>
-void Error(size_t line_id, Ts... message) {
-  std::cerr << "ERROR (line " << line_id << "): ";
-  (std::cerr << ... << std::forward<Ts>(message)) << std::endl;
-  exit(1);
+[[noreturn]] void Error(size_t line_id, Ts... message) {
+  ThrowDiagnostic(DiagnosticKind::Runtime, line_id, 0, std::forward<Ts>(message)...);
 }
 
 // Convert a bool value to a "" or "1"
 std::string StringBool(bool in) { return in ? "1" : ""; }
+
+// Parse a whole non-negative number (such as a command-line count) into 'out'.
+// Returns false, leaving 'out' alone, if 'in' is not entirely digits.
+inline bool ParseCount(std::string_view in, size_t & out) {
+  size_t value = 0;
+  auto [end, err] = std::from_chars(in.data(), in.data() + in.size(), value);
+  if (in.empty() || err != std::errc() || end != in.data() + in.size()) return false;
+  out = value;
+  return true;
+}
+
+// Parse a byte count with an optional K, M or G suffix (powers of 1024).
+inline bool ParseBytes(std::string_view in, size_t & out) {
+  size_t scale = 1;
+  if (!in.empty()) {
+    switch (in.back()) {
+      case 'K': case 'k': scale = size_t(1) << 10; break;
+      case 'M': case 'm': scale = size_t(1) << 20; break;
+      case 'G': case 'g': scale = size_t(1) << 30; break;
+    }
+    if (scale > 1) in.remove_suffix(1);
+  }
+  size_t value = 0;
+  if (!ParseCount(in, value) || value > SIZE_MAX / scale) return false;
+  out = value * scale;
+  return true;
+}
+
+// Parse a non-negative (possibly fractional) number of seconds.
+inline bool ParseSeconds(std::string_view in, double & out) {
+  double value = 0.0;
+  auto [end, err] = std::from_chars(in.data(), in.data() + in.size(), value);
+  if (in.empty() || err != std::errc() || end != in.data() + in.size() || !(value >= 0.0)) return false;
+  out = value;
+  return true;
+}
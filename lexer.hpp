@@ -4,17 +4,26 @@
 #include <algorithm>
 #include <array>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "Diagnostic.hpp"
+
 namespace emplex {
-  // Struct to store information about a found Token
+  // Struct to store information about a found Token.  The lexer keeps its
+  // tokens in compact arrays and builds these on request; 'lexeme' points
+  // into the lexer's copy of the input, so it lives as long as the lexer does.
   struct Token {
     int id;                             // Type ID for token
-    std::string lexeme;                 // Sequence matched by token
+    std::string_view lexeme;            // Sequence matched by token
     size_t line_id;                     // Line token started on
+    size_t column;                      // Column token started on
     operator int() const { return id; } // Auto-convert tokens to IDs
   };
 
@@ -22,11 +31,11 @@ namespace emplex {
   class DFA {
   private:
     // DFA transition table
-    static constexpr int NUM_STATES=62;
+    static constexpr int NUM_STATES=67;
     using row_t = std::array<int, 128>;
     static constexpr std::array<row_t, NUM_STATES> table = {{
-      /* State 0 */ {-1,-1,1,-1,-1,-1,-1,-1,-1,2,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,4,5,-1,-1,6,-1,7,8,9,-1,10,-1,11,-1,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,13,14,15,16,-1,17,17,17,17,18,17,17,17,19,17,17,17,17,17,17,20,17,17,17,17,17,21,22,17,17,17,-1,-1,-1,-1,17,-1,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,23,-1,24,-1,-1},
-      /* State 1 */ {-1,-1,1,-1,-1,-1,-1,-1,-1,2,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,4,5,-1,-1,6,-1,7,8,9,-1,10,-1,11,-1,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,13,14,15,16,-1,17,17,17,17,18,17,17,17,19,17,17,17,17,17,17,20,17,17,17,17,17,21,22,17,17,17,-1,-1,-1,-1,17,-1,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,23,-1,24,-1,-1},
+      /* State 0 */ {-1,-1,1,-1,-1,-1,-1,-1,-1,2,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,4,5,-1,-1,6,-1,7,8,9,-1,10,-1,11,-1,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,13,14,15,16,-1,17,17,17,17,18,17,17,17,19,17,17,17,17,17,17,20,17,62,17,17,17,21,22,17,17,17,-1,-1,-1,-1,17,-1,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,23,-1,24,-1,-1},
+      /* State 1 */ {-1,-1,1,-1,-1,-1,-1,-1,-1,2,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,4,5,-1,-1,6,-1,7,8,9,-1,10,-1,11,-1,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,13,14,15,16,-1,17,17,17,17,18,17,17,17,19,17,17,17,17,17,17,20,17,62,17,17,17,21,22,17,17,17,-1,-1,-1,-1,17,-1,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,23,-1,24,-1,-1},
       /* State 2 */ {-1,-1,-1,61,-1,-1,-1,-1,-1,2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
       /* State 3 */ {-1,-1,-1,3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
       /* State 4 */ {-1,-1,-1,59,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,60,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
@@ -86,17 +95,22 @@ namespace emplex {
       /* State 58 */ {-1,-1,-1,54,-1,-1,-1,-1,-1,5,-1,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,54,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,57,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5},
       /* State 59 */ {-1,-1,-1,59,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
       /* State 60 */ {-1,-1,-1,60,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-      /* State 61 */ {-1,-1,-1,61,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1}
+      /* State 61 */ {-1,-1,-1,61,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
+      /* State 62 */ {-1,-1,-1,25,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,-1,-1,-1,17,17,17,17,63,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,17,-1,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,-1},
+      /* State 63 */ {-1,-1,-1,25,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,-1,-1,-1,64,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,17,-1,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,-1},
+      /* State 64 */ {-1,-1,-1,25,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,-1,-1,-1,17,17,17,65,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,17,-1,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,-1},
+      /* State 65 */ {-1,-1,-1,66,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,-1,-1,-1,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,17,-1,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,17,-1,-1,-1,-1,-1},
+      /* State 66 */ {-1,-1,-1,66,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1}
     }};
     // DFA stop states (0 indicates NOT a stop)
-    static constexpr std::array<int, NUM_STATES> stop_id = {0,0,230,229,243,0,238,0,237,236,241,240,239,246,244,245,242,233,233,233,233,233,233,235,234,233,233,233,233,253,253,233,252,252,233,233,233,251,251,255,255,233,233,254,254,245,247,244,250,246,248,239,231,231,232,0,232,0,232,243,249,230};
+    static constexpr std::array<int, NUM_STATES> stop_id = {0,0,229,228,242,0,237,0,236,235,240,239,238,245,243,244,241,232,232,232,232,232,232,234,233,232,232,232,232,253,253,232,252,252,232,232,232,251,251,255,255,232,232,254,254,244,246,243,249,245,247,238,230,230,231,0,231,0,231,242,248,229,232,232,232,250,250};
 
   public:
     constexpr static int SYMBOL_START = 2;     ///< Symbol to indicate a start of line.
     constexpr static int SYMBOL_STOP = 3;      ///< Symbol to indicate an end of line.
     constexpr static int SYMBOL_MIN_INPUT = 9; ///< Symbols below this are control symbols.
 
-    static constexpr size_t size() { return 62; }
+    static constexpr size_t size() { return 67; }
     static constexpr int GetStop(int state) {
       return (state >= 0) ? stop_id[static_cast<size_t>(state)] : 0;
     }
@@ -120,43 +134,68 @@ namespace emplex {
 
   class Lexer {
   private:
-    static constexpr int NUM_TOKENS=27;
+    static constexpr int NUM_TOKENS=28;
 
     // -- Load State --
     size_t cur_line = 1;   // Track LINE we are reading in the input.
     size_t cur_col = 0;    // Track COLUMN we are reading in the input.
     int start_pos = 0;     // Track INDEX for the start of current lexeme.
-    std::string lexeme{};  // Lexeme found for the current token
 
     // -- Process State --
-    std::vector<Token> tokens{}; // Set of tokens loaded so far.
-    size_t token_id = 0;                 // Next token to process.
-    const Token eof_token{0, "_EOF_", 0};
+    // Tokens are stored as parallel arrays, so scans that only look at token
+    // types (matching braces, skipping blocks) walk one dense byte array.
+    std::string source{};                 // Input text that lexemes point into.
+    std::vector<uint8_t> ids{};           // Type of each token.
+    std::vector<uint32_t> offsets{};      // Start of each lexeme in 'source'.
+    std::vector<uint32_t> lengths{};      // Length of each lexeme.
+    std::vector<uint32_t> lines{};        // Line each token starts on...
+    std::vector<uint32_t> line_starts{};  // ...and where each line starts in 'source'.
+    size_t token_id = 0;                  // Next token to process.
+    static constexpr Token eof_token{0, "_EOF_", 0, 0};
+
+    // -- Line Memo --
+    // Generated scripts repeat the same line text many times.  Tokens never
+    // span lines, so a line's tokens depend only on its text: Tokenize()
+    // remembers the tokens of lines it has lexed (as offsets within the
+    // line) and copies them for later lines with the same text.  Keys view
+    // 'source', so the memo is cleared on each Tokenize().
+    struct MemoToken { uint8_t id; uint32_t offset; uint32_t length; };
+    struct MemoLine { uint32_t first; uint32_t count; };   // Range in memo_tokens
+    static constexpr size_t MEMO_MIN_LINE = 8;        // Shorter lines are cheaper to lex again.
+    static constexpr size_t MEMO_MAX_LINES = 4096;    // The memo is cleared beyond this...
+    static constexpr size_t MEMO_PAUSE_LINES = 65536; // ...and rested this long if it rarely hit.
+    std::unordered_map<std::string_view, MemoLine> memo_lines{};
+    std::vector<MemoToken> memo_tokens{};
+    size_t memo_hits = 0;         // Since the memo was last cleared
+    size_t memo_pause = 0;        // Lines left to lex without the memo
+    bool use_memo = true;
 
   public:
     static constexpr int ID__EOF_ = 0;
-    static constexpr int ID_NEWLINE = 229;          // Regex: \n
-    static constexpr int ID_WHITESPACE = 230;       // Regex: [ \t]+
-    static constexpr int ID_COMMENT = 231;          // Regex: "//".*
-    static constexpr int ID_LIT_STRING = 232;       // Regex: (\"([^\n\"]|(\\.))*\")|(\'([^\n\']|(\\.))*\')
-    static constexpr int ID_ID = 233;               // Regex: [a-zA-Z_][a-zA-Z0-9_]*
-    static constexpr int ID_RBRACE = 234;           // Regex: \}
-    static constexpr int ID_LBRACE = 235;           // Regex: \{
-    static constexpr int ID_RPAREN = 236;           // Regex: \)
-    static constexpr int ID_LPAREN = 237;           // Regex: \(
-    static constexpr int ID_PERCENT = 238;          // Regex: %
-    static constexpr int ID_SLASH = 239;            // Regex: /
-    static constexpr int ID_MINUS = 240;            // Regex: \-
-    static constexpr int ID_PLUS = 241;             // Regex: \+
-    static constexpr int ID_QUESTION = 242;         // Regex: \?
-    static constexpr int ID_NOT = 243;              // Regex: !
-    static constexpr int ID_ASSIGN = 244;           // Regex: =
-    static constexpr int ID_GT = 245;               // Regex: >
-    static constexpr int ID_LT = 246;               // Regex: <
-    static constexpr int ID_GE = 247;               // Regex: >=
-    static constexpr int ID_LE = 248;               // Regex: <=
-    static constexpr int ID_NEQ = 249;              // Regex: !=
-    static constexpr int ID_EQ = 250;               // Regex: ==
+    static constexpr int ID_BAD_BYTE = 128;         // Any non-ASCII byte outside a token
+    static constexpr int ID_NEWLINE = 228;          // Regex: \n
+    static constexpr int ID_WHITESPACE = 229;       // Regex: [ \t]+
+    static constexpr int ID_COMMENT = 230;          // Regex: "//".*
+    static constexpr int ID_LIT_STRING = 231;       // Regex: (\"([^\n\"]|(\\.))*\")|(\'([^\n\']|(\\.))*\')
+    static constexpr int ID_ID = 232;               // Regex: [a-zA-Z_][a-zA-Z0-9_]*
+    static constexpr int ID_RBRACE = 233;           // Regex: \}
+    static constexpr int ID_LBRACE = 234;           // Regex: \{
+    static constexpr int ID_RPAREN = 235;           // Regex: \)
+    static constexpr int ID_LPAREN = 236;           // Regex: \(
+    static constexpr int ID_PERCENT = 237;          // Regex: %
+    static constexpr int ID_SLASH = 238;            // Regex: /
+    static constexpr int ID_MINUS = 239;            // Regex: \-
+    static constexpr int ID_PLUS = 240;             // Regex: \+
+    static constexpr int ID_QUESTION = 241;         // Regex: \?
+    static constexpr int ID_NOT = 242;              // Regex: !
+    static constexpr int ID_ASSIGN = 243;           // Regex: =
+    static constexpr int ID_GT = 244;               // Regex: >
+    static constexpr int ID_LT = 245;               // Regex: <
+    static constexpr int ID_GE = 246;               // Regex: >=
+    static constexpr int ID_LE = 247;               // Regex: <=
+    static constexpr int ID_NEQ = 248;              // Regex: !=
+    static constexpr int ID_EQ = 249;               // Regex: ==
+    static constexpr int ID_READ = 250;             // Regex: READ
     static constexpr int ID_PRINT = 251;            // Regex: PRINT
     static constexpr int ID_VAR = 252;              // Regex: VAR
     static constexpr int ID_WHILE = 253;            // Regex: WHILE
@@ -190,6 +229,7 @@ namespace emplex {
       case ID_LE: return "LE";
       case ID_NEQ: return "NEQ";
       case ID_EQ: return "EQ";
+      case ID_READ: return "READ";
       case ID_PRINT: return "PRINT";
       case ID_VAR: return "VAR";
       case ID_WHILE: return "WHILE";
@@ -212,20 +252,23 @@ namespace emplex {
     static constexpr bool IgnoreToken(int id) {
       switch (id) {
       case 0:
+      case 229:
       case 230:
-      case 231:
         return true;
       default: return false;
       };
     }
 
+    // Turn the line memo on or off (for benchmarking; it is on by default).
+    void SetLineMemo(bool enabled) { use_memo = enabled; }
+
     // Return the number of token types the lexer recognizes.
     static constexpr int GetNumTokens() { return NUM_TOKENS; }
 
     // Generate and return the next token from the input stream.
     Token NextToken(std::string_view in) {
       // If we cannot read in, return an "EOF" token.
-      if (start_pos >= std::ssize(in)) return { 0, "", cur_line };
+      if (start_pos >= std::ssize(in)) return { 0, {}, cur_line, cur_col+1 };
 
       int cur_pos = start_pos;  // Position in the input that we are actively analyzing
       int best_pos = start_pos; // Best look-ahead we've found so far
@@ -257,9 +300,12 @@ namespace emplex {
       }
 
       // If we did not find any options, peel off just one character and use it as id.
-      if (best_pos == start_pos) { best_stop=in[start_pos]; ++best_pos;}
+      if (best_pos == start_pos) {
+        best_stop = (in[start_pos] < 0) ? ID_BAD_BYTE : in[start_pos];
+        ++best_pos;
+      }
 
-      lexeme = in.substr(start_pos, best_pos-start_pos);
+      const std::string_view lexeme = in.substr(start_pos, best_pos-start_pos);
       start_pos += std::ssize(lexeme);
 
       // Update the line number we are on.
@@ -273,64 +319,244 @@ namespace emplex {
       }
 
       // Return the token we found.
-      return { best_stop, lexeme, out_line };
+      return { best_stop, lexeme, out_line, out_col+1 };
     }
 
-    // Convert an input string into a vector of tokens.
-    const std::vector<Token> & Tokenize(std::string_view in) {
+    // Convert an input string into tokens; returns how many were kept.
+    size_t Tokenize(std::string in) {
+      source = std::move(in);
+      if (source.size() > UINT32_MAX) {
+        ThrowDiagnostic(DiagnosticKind::Lexical, 1, 0, "Input larger than 4 GB is not supported");
+      }
       start_pos = 0; // Start processing at beginning of string.
       cur_line = 1;  // Start processing at the first line of the input.
       cur_col = 0;   // Start processing at the first position of the input.
-      tokens.resize(0);
+      ids.clear(); offsets.clear(); lengths.clear(); lines.clear();
+      line_starts.assign(1, 0);
       token_id = 0;
-      while (Token token = NextToken(in)) {
-        if (!IgnoreToken(token.id)) tokens.push_back(token);
+      memo_lines.clear();
+      memo_tokens.clear();
+      memo_hits = memo_pause = 0;
+      const size_t size = source.size();
+      while (static_cast<size_t>(start_pos) < size) {
+        const size_t line_start = static_cast<size_t>(start_pos);
+        const void * newline = std::memchr(source.data() + line_start, '\n', size - line_start);
+        const size_t line_end = newline ? static_cast<const char *>(newline) - source.data() + 1 : size;
+        const std::string_view text(source.data() + line_start, line_end - line_start);
+        if (memo_pause > 0) --memo_pause;
+        const bool memoize = use_memo && memo_pause == 0 && text.size() >= MEMO_MIN_LINE &&
+                             (line_start == 0 || source[line_start - 1] == '\n');
+
+        if (memoize) {
+          if (auto it = memo_lines.find(text); it != memo_lines.end()) {
+            ++memo_hits;
+            for (uint32_t i = 0; i < it->second.count; ++i) {
+              const MemoToken & token = memo_tokens[it->second.first + i];
+              ids.push_back(token.id);
+              offsets.push_back(static_cast<uint32_t>(line_start + token.offset));
+              lengths.push_back(token.length);
+              lines.push_back(static_cast<uint32_t>(cur_line));
+            }
+            start_pos = static_cast<int>(line_end);
+            cur_col = 0;
+            if (newline) { line_starts.push_back(static_cast<uint32_t>(line_end)); ++cur_line; }
+            continue;
+          }
+        }
+
+        const size_t first_token = ids.size();
+        while (static_cast<size_t>(start_pos) < line_end) {
+          const Token token = NextToken(source);
+          if (token.id == ID_NEWLINE) line_starts.push_back(static_cast<uint32_t>(start_pos));
+          if (IgnoreToken(token.id)) continue;
+          ids.push_back(static_cast<uint8_t>(token.id));
+          offsets.push_back(static_cast<uint32_t>(token.lexeme.data() - source.data()));
+          lengths.push_back(static_cast<uint32_t>(token.lexeme.size()));
+          lines.push_back(static_cast<uint32_t>(token.line_id));
+        }
+        // A token that ran past the end of the line would make this line's
+        // tokens depend on the next one; never the case for this grammar.
+        if (!memoize || static_cast<size_t>(start_pos) != line_end) continue;
+        if (memo_lines.size() >= MEMO_MAX_LINES) {
+          // Mostly distinct lines: hashing them costs more than it saves.
+          if (memo_hits < MEMO_MAX_LINES) memo_pause = MEMO_PAUSE_LINES;
+          memo_lines.clear();
+          memo_tokens.clear();
+          memo_hits = 0;
+          if (memo_pause > 0) continue;
+        }
+        memo_lines.emplace(text, MemoLine{ static_cast<uint32_t>(memo_tokens.size()),
+                                           static_cast<uint32_t>(ids.size() - first_token) });
+        for (size_t i = first_token; i < ids.size(); ++i) {
+          memo_tokens.push_back({ ids[i], static_cast<uint32_t>(offsets[i] - line_start), lengths[i] });
+        }
       }
-      return tokens;
+      return ids.size();
     }
 
-    // Convert an input stream to a string, then tokenize.
-    const std::vector<Token> & Tokenize(std::istream & is) {
+    // Read an input stream into a string, then tokenize.
+    size_t Tokenize(std::istream & is) {
       return Tokenize(
         std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>())
       );
     }
 
+    // Length of the common prefix (or suffix) of two strings, compared a
+    // block at a time so unchanged megabytes go by at memcmp speed.
+    static size_t CommonPrefix(std::string_view a, std::string_view b) {
+      constexpr size_t BLOCK = 4096;
+      const size_t limit = std::min(a.size(), b.size());
+      size_t pos = 0;
+      while (pos + BLOCK <= limit && std::memcmp(a.data() + pos, b.data() + pos, BLOCK) == 0) pos += BLOCK;
+      while (pos < limit && a[pos] == b[pos]) ++pos;
+      return pos;
+    }
+    static size_t CommonSuffix(std::string_view a, std::string_view b, size_t limit) {
+      constexpr size_t BLOCK = 4096;
+      size_t len = 0;
+      while (len + BLOCK <= limit &&
+             std::memcmp(a.end() - len - BLOCK, b.end() - len - BLOCK, BLOCK) == 0) len += BLOCK;
+      while (len < limit && a[a.size() - len - 1] == b[b.size() - len - 1]) ++len;
+      return len;
+    }
+
+    // Replace 'vec[first, last)' with 'with'.
+    template <typename T>
+    static void Splice(std::vector<T> & vec, size_t first, size_t last, const std::vector<T> & with) {
+      const size_t old_size = vec.size();
+      if (with.size() > last - first) vec.resize(old_size + with.size() - (last - first));
+      std::copy_backward(vec.begin() + last, vec.begin() + old_size,
+                         vec.begin() + old_size + with.size() - (last - first));
+      std::copy(with.begin(), with.end(), vec.begin() + first);
+      if (with.size() < last - first) vec.resize(old_size - (last - first) + with.size());
+    }
+
+    // Replace the input with an edited version of it, keeping the tokens on
+    // the unchanged lines at the start and end.  No token crosses a newline,
+    // so only the lines in between are lexed again; the tokens after them
+    // are just shifted.  Returns the number of lines lexed.
+    size_t Relex(std::string in) {
+      if (in.size() > UINT32_MAX) {
+        ThrowDiagnostic(DiagnosticKind::Lexical, 1, 0, "Input larger than 4 GB is not supported");
+      }
+      const std::string_view old_text = source, new_text = in;
+
+      // Unchanged lines at the start: up to the last newline both share.
+      const size_t common = CommonPrefix(old_text, new_text);
+      const size_t nl = (common == 0) ? std::string_view::npos : new_text.rfind('\n', common - 1);
+      const size_t head_end = (nl == std::string_view::npos) ? 0 : nl + 1;
+
+      // Unchanged lines at the end: from the first line start inside the
+      // common suffix (which must not overlap the unchanged head).
+      size_t tail = CommonSuffix(old_text, new_text, std::min(old_text.size(), new_text.size()) - head_end);
+      const size_t tail_nl = old_text.substr(old_text.size() - tail).find('\n');
+      tail = (tail_nl == std::string_view::npos) ? 0 : tail - tail_nl - 1;
+      const size_t old_tail_start = old_text.size() - tail;
+      const size_t new_tail_start = new_text.size() - tail;
+
+      // Old tokens and line starts in [first, last) belong to changed lines.
+      auto first_at = [](const std::vector<uint32_t> & vec, size_t pos) {
+        return static_cast<size_t>(std::lower_bound(vec.begin(), vec.end(), pos) - vec.begin());
+      };
+      const size_t first_token = first_at(offsets, head_end);
+      const size_t last_token = first_at(offsets, old_tail_start);
+      const size_t first_line = first_at(line_starts, head_end + 1);      // Line of head_end
+      const size_t last_line = first_at(line_starts, old_tail_start + 1);
+
+      // Lex the changed lines.
+      source = std::move(in);
+      std::vector<uint8_t> new_ids;
+      std::vector<uint32_t> new_offsets, new_lengths, new_lines, new_line_starts;
+      start_pos = static_cast<int>(head_end);
+      cur_line = first_line;
+      cur_col = 0;
+      const std::string_view middle = std::string_view(source).substr(0, new_tail_start);
+      while (Token token = NextToken(middle)) {
+        if (token.id == ID_NEWLINE) new_line_starts.push_back(static_cast<uint32_t>(start_pos));
+        if (IgnoreToken(token.id)) continue;
+        new_ids.push_back(static_cast<uint8_t>(token.id));
+        new_offsets.push_back(static_cast<uint32_t>(token.lexeme.data() - source.data()));
+        new_lengths.push_back(static_cast<uint32_t>(token.lexeme.size()));
+        new_lines.push_back(static_cast<uint32_t>(token.line_id));
+      }
+
+      // Shift the tail to its new position, then splice in the new tokens.
+      const uint32_t byte_shift = static_cast<uint32_t>(new_tail_start - old_tail_start);   // Wraps if negative
+      const uint32_t line_shift = static_cast<uint32_t>(new_line_starts.size() - (last_line - first_line));
+      for (size_t i = last_token; i < offsets.size(); ++i) { offsets[i] += byte_shift; lines[i] += line_shift; }
+      for (size_t i = last_line; i < line_starts.size(); ++i) line_starts[i] += byte_shift;
+      Splice(ids, first_token, last_token, new_ids);
+      Splice(offsets, first_token, last_token, new_offsets);
+      Splice(lengths, first_token, last_token, new_lengths);
+      Splice(lines, first_token, last_token, new_lines);
+      Splice(line_starts, first_line, last_line, new_line_starts);
+
+      token_id = 0;
+      return new_line_starts.size() + (new_tail_start > head_end && source[new_tail_start - 1] != '\n');
+    }
+
+    size_t NumTokens() const { return ids.size(); }
+
+    // Build the full token at index 'pos' (which must be in range).
+    Token At(size_t pos) const {
+      const uint32_t line = lines[pos];
+      return { ids[pos], std::string_view(source.data() + offsets[pos], lengths[pos]),
+               line, offsets[pos] - line_starts[line - 1] + 1 };
+    }
+
+    // Index of a token built by At() (or Use()/Peek()) from this lexer.
+    size_t PosOf(const Token & token) const {
+      const auto offset = static_cast<uint32_t>(token.lexeme.data() - source.data());
+      return static_cast<size_t>(std::lower_bound(offsets.begin(), offsets.end(), offset) - offsets.begin());
+    }
+
+    // The text being lexed.
+    std::string_view Source() const { return source; }
+
     // === Functions for Using Tokens ===
 
-    // Write an error message for invalid tokens and terminate the program.
+    // Report an invalid token by throwing a Diagnostic at the current position.
     template <typename... Ts>
-    void Error(Ts... message) {
-      std::cerr << "ERROR (line " << Peek().line_id <<  "): ";
-      (std::cerr << ... << std::forward<Ts>(message)) << std::endl;
-      exit(1);
+    [[noreturn]] void Error(Ts... message) {
+      ThrowDiagnostic(DiagnosticKind::Lexical, Peek().line_id, Peek().column,
+                      std::forward<Ts>(message)...);
     }
 
     // Test if there are ANY tokens remaining.
-    bool Any() const { return token_id < tokens.size(); }
+    bool Any() const { return token_id < ids.size(); }
 
     // Test if there are NO tokens remaining.
-    bool None() const { return token_id >= tokens.size(); }
+    bool None() const { return token_id >= ids.size(); }
 
     // Test if the current token is a specific type.
-    bool Is(int id) const { return Any() && Peek() == id; }
+    bool Is(int id) const { return Any() && ids[token_id] == id; }
+
+    // Type of the current (or upcoming) token; 0 past the end.  Cheaper than
+    // Peek() when only the type is needed.
+    int PeekId(size_t skip_count=0) const {
+      if (token_id + skip_count >= ids.size()) return 0;
+      return ids[token_id + skip_count];
+    }
 
     // Get the current (or upcoming) token, but don't remove it from the queue.
-    const Token & Peek(size_t skip_count=0) const {
-      if (token_id + skip_count >= tokens.size()) return eof_token;
-      return tokens[token_id + skip_count];
+    Token Peek(size_t skip_count=0) const {
+      if (token_id + skip_count >= ids.size()) return eof_token;
+      return At(token_id + skip_count);
     }
 
     // Get the current token, removing it from the queue.
-    const Token & Use() {
+    Token Use() {
       if (None()) return eof_token;
-      return tokens[token_id++];
+      return At(token_id++);
     }
 
+    // Skip the current token without building it.
+    void Skip() { if (Any()) ++token_id; }
+
     // Use the current token if it is the expected type; otherwise error.
     // (Use provided error if available, otherwise use default error)
     template <typename... Ts>
-    const Token & Use(int id, Ts &&... message) {
+    Token Use(int id, Ts &&... message) {
       if (!Is(id)) {
         if constexpr (sizeof...(Ts) == 0) {
           Error( "Expected token of type ", TokenName(id),
@@ -357,6 +583,10 @@ namespace emplex {
       if (token_id >= steps) token_id -= steps;
       else token_id = 0;
     }
+
+    // Get or set the index of the next token to process.
+    size_t GetPos() const { return token_id; }
+    void SetPos(size_t pos) { token_id = std::min(pos, ids.size()); }
   };
 } // End of namespace emplex
 #endif // #ifndef EMPLEX_LEXER_HPP_INCLUDE_
@@ -1,7 +1,7 @@
 #!/usr/bin/env bash
 
 # Run from the tests/ directory
-BIN="../Project2"
+BIN="${1:-../Project2}"   # ./run_tests.sh [binary]
 EXPECTED_DIR="expected"
 CURRENT_DIR="current"
 
@@ -26,6 +26,8 @@ for exp in "${tests[@]}"; do
   code_file="${id}.sstack"
   out_file="${CURRENT_DIR}/${id}.current"
   status_file="${EXPECTED_DIR}/${id}.status"
+  input_file="${id}.input"        # Optional stdin for READ
+  args_file="${id}.args"          # Optional command-line options
 
   if [[ ! -x "$BIN" ]]; then
     echo "Missing executable: $BIN"
@@ -37,10 +39,19 @@ for exp in "${tests[@]}"; do
     continue
   fi
 
+  [[ -f "$input_file" ]] || input_file=/dev/null
+  args=()
+  [[ -f "$args_file" ]] && read -r -a args < "$args_file"
+
   # Run, capture BOTH stdout and stderr, and the exit code
-  "$BIN" "$code_file" >"$out_file" 2>&1
+  "$BIN" "${args[@]}" "$code_file" <"$input_file" >"$out_file" 2>&1
   rc=$?
 
+  # --stats times and byte counts differ from run to run; compare the rest.
+  if [[ " ${args[*]} " == *" --stats "* ]]; then
+    sed -i -E '/seconds|bytes/d' "$out_file"
+  fi
+
   expected_rc=0
   if [[ -f "$status_file" ]]; then
     expected_rc=$(tr -d '[:space:]' < "$status_file")
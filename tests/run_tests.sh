@@ -1,7 +1,7 @@
 #!/usr/bin/env bash
 
 # Run from the tests/ directory
-BIN="../Project2"
+BIN="${1:-../Project2}"   # ./run_tests.sh [binary]
 EXPECTED_DIR="expected"
 CURRENT_DIR="current"
 
@@ -26,6 +26,7 @@ for exp in "${tests[@]}"; do
   code_file="${id}.sstack"
   out_file="${CURRENT_DIR}/${id}.current"
   status_file="${EXPECTED_DIR}/${id}.status"
+  input_file="${id}.input"        # Optional stdin for READ
 
   if [[ ! -x "$BIN" ]]; then
     echo "Missing executable: $BIN"
@@ -37,8 +38,10 @@ for exp in "${tests[@]}"; do
     continue
   fi
 
+  [[ -f "$input_file" ]] || input_file=/dev/null
+
   # Run, capture BOTH stdout and stderr, and the exit code
-  "$BIN" "$code_file" >"$out_file" 2>&1
+  "$BIN" "$code_file" <"$input_file" >"$out_file" 2>&1
   rc=$?
 
   expected_rc=0
@@ -0,0 +1,57 @@
+// Print a trace file written by "Project2-trace --trace FILE" as text.
+// Build with "make trace_decode"; run as: tools/trace_decode FILE
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+
+#include "../Trace.hpp"
+
+// Show a (possibly cut short) value, marking how much was dropped.
+static void PrintValue(const trace::Record & rec) {
+  std::cout << '"' << std::string_view(rec.text, rec.text_size) << '"';
+  if (rec.number > rec.text_size) std::cout << "... (" << rec.number << " bytes)";
+}
+
+int main(int argc, char * argv[]) {
+  if (argc != 2) {
+    std::cout << "Format: " << argv[0] << " [tracefile]" << std::endl;
+    return 1;
+  }
+
+  std::ifstream in(argv[1], std::ios::binary);
+  trace::FileHeader header{};
+  if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, trace::MAGIC, sizeof(trace::MAGIC)) != 0 ||
+      header.record_size != sizeof(trace::Record)) {
+    std::cerr << "ERROR: '" << argv[1] << "' is not a trace file" << std::endl;
+    return 1;
+  }
+
+  const uint64_t first = header.total - header.stored;
+  if (first > 0) std::cout << "(" << first << " earlier events were overwritten)\n";
+
+  trace::Record rec;
+  for (uint64_t i = first; i < header.total; ++i) {
+    if (!in.read(reinterpret_cast<char *>(&rec), sizeof(rec))) {
+      std::cerr << "ERROR: trace file is truncated" << std::endl;
+      return 1;
+    }
+    const std::string_view name(rec.name, rec.name_size);
+    std::cout << '#' << i << " line " << rec.line << ": ";
+    switch (rec.kind) {
+      case trace::Kind::Statement: std::cout << "exec " << name; break;
+      case trace::Kind::Read:      std::cout << "read " << name << " = "; PrintValue(rec); break;
+      case trace::Kind::Assign:    std::cout << "set " << name << " = "; PrintValue(rec); break;
+      case trace::Kind::Branch:
+        std::cout << name << (rec.number ? " taken" : " skipped");
+        break;
+      case trace::Kind::Loop:      std::cout << "WHILE iteration " << rec.number; break;
+      case trace::Kind::LoopEnd:   std::cout << "WHILE done after " << rec.number << " iterations"; break;
+      default:                     std::cout << "unknown event " << static_cast<int>(rec.kind);
+    }
+    std::cout << '\n';
+  }
+  return 0;
+}